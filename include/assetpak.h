@@ -0,0 +1,69 @@
+#pragma once
+
+#include <allegro5/allegro.h>
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Archive of pre-decoded images, each stored at a few widths.
+ * <p>
+ * Layout: a header, an index of fixed size records, and raw pixel data in
+ * ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE (bytes R, G, B, A), rows tightly packed.
+ * All numbers are little endian. The file is mapped into memory as is, and the header and
+ * records are the structs below, written and read as they are in memory. That is only
+ * the documented layout on little endian hosts, which is checked when compiling.
+ * Reading an image is a single copy into a bitmap.
+ */
+class AssetPak {
+public:
+	struct Header {
+		char magic[4]; // "KPAK"
+		uint32_t version;
+		uint32_t count; // number of index records
+		uint32_t reserved;
+	};
+
+	struct Record {
+		char id[48]; // zero terminated
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset; // of the pixel data, from the start of the file
+	};
+
+	static_assert(sizeof(Header) == 16 && sizeof(Record) == 64, "no padding in the archive structs");
+	static_assert(std::endian::native == std::endian::little, "archives are little endian");
+
+	static const uint32_t VERSION = 1;
+private:
+	const uint8_t *data;
+	size_t size;
+	std::vector<uint8_t> fallback; // file contents, if it couldn't be mapped
+	void unmap();
+public:
+	AssetPak() : data(nullptr), size(0), fallback() {}
+	AssetPak(const AssetPak &) = delete;
+	AssetPak &operator=(const AssetPak &) = delete;
+	~AssetPak() { unmap(); }
+
+	/** returns false if the file doesn't exist or isn't a valid archive */
+	bool open(const std::string &path);
+	bool isOpen() const { return data != nullptr; }
+
+	size_t getCount() const;
+	const Record &getRecord(size_t i) const;
+
+	/** The largest version of an image that isn't wider than maxWidth, or else the smallest. NULL if not found */
+	const Record *find(const std::string &id, int maxWidth) const;
+
+	/** Copy the pixels of a record into a new bitmap, created with the current new bitmap flags */
+	ALLEGRO_BITMAP *createBitmap(const Record &record) const;
+
+	/**
+	 * Write an archive of all images in dir, scaled down to each of the given widths
+	 * that is smaller than the original. Images wider than the largest width are scaled down to that.
+	 * Returns false on failure.
+	 */
+	static bool pack(const std::string &dir, const std::string &path, const std::vector<int> &widths);
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <allegro5/allegro.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "assetpak.h"
+#include "jobs.h"
+
+struct ALLEGRO_SAMPLE;
+
+/**
+ * Story images and samples, loaded on demand instead of all at startup.
+ * <p>
+ * Only the directory is indexed up front. Assets that are about to be needed can be
+ * prefetched: they are decoded in background jobs into memory bitmaps, which are uploaded
+ * to video memory in the job completions, within the main loop's budget per frame.
+ * Anything that is neither prefetched nor pinned is unloaded again.
+ * <p>
+ * Video memory used by images, and memory used by decoded samples, are each kept under a budget,
+ * by evicting the least recently used assets that aren't pinned (or still playing).
+ * They are loaded again, from the archive or from disk, when needed.
+ * Long sounds aren't decoded at all, they should be streamed from getPath().
+ * <p>
+ * If the directory contains an archive made with -packassets, images are read from there
+ * at the size closest to the target width, without decoding. Other images are scaled down on load.
+ * <p>
+ * All public methods must be called from the display thread.
+ */
+class Assets {
+public:
+	enum Kind { IMAGE, SAMPLE, KIND_NUM };
+private:
+	struct Entry {
+		enum State { UNLOADED, QUEUED, DECODING, DECODED, READY, FAILED };
+
+		Kind kind;
+		std::string id;
+		std::string path;
+		bool packed; // in the archive
+		bool streamed; // too long to decode in full
+		State state;
+		ALLEGRO_BITMAP *bmp; // memory bitmap while DECODED, video bitmap when READY
+		ALLEGRO_SAMPLE *sample;
+		JobSystem::Handle job; // while QUEUED or DECODING in the background
+		bool unloadWhenDone; // left the prefetch set while DECODING
+		int pins;
+		uint64_t lastUsed;
+		double playingUntil; // samples: not evicted before this time
+	};
+
+	std::map<std::string, Entry> entries[KIND_NUM]; // by file name without extension
+
+	// guards state, bmp, sample and job of all entries
+	std::mutex lockMutex;
+	std::condition_variable cond; // an entry is no longer DECODING
+	JobSystem &jobs;
+
+	AssetPak pak;
+	std::atomic<int> targetWidth; // read by the workers
+
+	size_t usedBytes[KIND_NUM]; // of all READY assets
+	int resident[KIND_NUM]; // number of READY assets
+	size_t budget[KIND_NUM];
+	uint64_t useCounter;
+
+	void index(const std::string &dir);
+	Entry *find(Kind kind, const std::string &id);
+	Entry &add(Kind kind, const std::string &id, const std::string &path, int64_t fileSize);
+	ALLEGRO_BITMAP *loadImage(const Entry &entry);
+	void decode(Entry &entry, bool video);
+	void queue(Entry &entry);
+	void upload(Entry &entry);
+	void unload(Entry &entry);
+	void evict(Kind kind);
+	static size_t memorySize(const Entry &entry);
+	Entry *get(Kind kind, const std::string &id, std::unique_lock<std::mutex> &lock);
+public:
+	Assets(const std::string &dir, JobSystem &jobs);
+	Assets(const Assets &) = delete;
+	Assets &operator=(const Assets &) = delete;
+	~Assets();
+
+	bool exists(Kind kind, const std::string &id) { return find(kind, id) != nullptr; }
+
+	/** Returns the asset, loading it right now if it wasn't prefetched. NULL if it doesn't exist */
+	ALLEGRO_BITMAP *getBitmap(const std::string &id);
+	ALLEGRO_SAMPLE *getSample(const std::string &id);
+
+	/** Images are shown no wider than this. Only affects images loaded from then on */
+	void setTargetWidth(int value) { targetWidth = value; }
+
+	/** Memory for images (in video memory) or samples, beyond which unpinned assets are evicted */
+	void setBudget(Kind kind, size_t bytes) { budget[kind] = bytes; }
+	size_t getBytes(Kind kind) const { return usedBytes[kind]; }
+
+	/** Sounds that are too long to keep decoded in memory */
+	bool isStreamed(const std::string &id);
+	/** File to stream a sound from */
+	std::string getPath(Kind kind, const std::string &id);
+
+	/** Pinned assets are never unloaded */
+	void pin(Kind kind, const std::string &id);
+	void unpin(Kind kind, const std::string &id);
+
+	/**
+	 * Replace the prefetch set: decode these in the background,
+	 * and unload all other assets that aren't pinned.
+	 */
+	void prefetch(const std::vector<std::string> &images, const std::vector<std::string> &samples);
+
+	/** Stay within the budget. Call once per frame */
+	void update();
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+/**
+ * Like al_get_clipping_rectangle and al_set_clipping_rectangle, but in the coordinates
+ * of the current transform instead of target pixels. They are the same, unless the
+ * main loop scales with a transform. Only scaling and translation are taken into account.
+ */
+void getClippingRectangle(int *x, int *y, int *w, int *h);
+void setClippingRectangle(int x, int y, int w, int h);
@@ -6,13 +6,17 @@
 #include "simpleloop.h"
 
 class Resources;
+class Assets;
 
 class Engine : public Simple::IApp {
 
 private:
 	static std::shared_ptr<Resources> resources;
+	static std::shared_ptr<Assets> assets;
 	static ALLEGRO_FONT *font;
 	static bool debugMode;
+	static bool statsMode; // F12: show engine counters
+	void drawStats();
 public:
 	enum { E_NONE = 0, E_START, E_QUIT };
 	std::shared_ptr<Game> game;
@@ -25,6 +29,7 @@ public:
 		al_set_clipping_rectangle(0, 0, ScreenW, ScreenH);
 		 */
 		game->draw(gc);
+		if (statsMode) drawStats();
 	}
 
 	virtual ~Engine();
@@ -36,10 +41,13 @@ public:
 	}
 
 	static std::shared_ptr<Resources> getResources() { return resources; }
+	/** story images and samples, loaded on demand */
+	static std::shared_ptr<Assets> getAssets() { return assets; }
 
 	static ALLEGRO_FONT *getFont() { return font; }
 	//TODO: Engine has series of global accessors including getFont(), getResources(), and isDebug() flag.
 
-	void init();
-	virtual bool update() override;
+	/** Returns false if there is no game to run: after -packassets, or on failure. exitCode is set then */
+	bool init(int &exitCode);
+	virtual Simple::UpdateResult update() override;
 };
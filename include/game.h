@@ -2,6 +2,7 @@
 
 #include "text2.h"
 #include <memory>
+#include <vector>
 #include "state.h"
 
 class Resources;
@@ -14,10 +15,18 @@ public:
 	virtual void draw(const GraphicsContext &gc) override = 0;
 	virtual void init(std::shared_ptr<Resources> res) = 0;
 	virtual void handleEvent(ALLEGRO_EVENT &event) override = 0;
+	/** true if nothing on screen is moving, and nothing will until the next input */
+	virtual bool isIdle() = 0;
+	/** Answers to choose automatically, by number counting from 1, as soon as they are shown */
+	virtual void setScriptedAnswers(const std::vector<int> &answers) = 0;
 
 	virtual void initGame() = 0;
+	/** Continue from the autosave journal, or start a new game if there is none. Only at startup with -continue or game/resume=1 */
+	virtual void continueGame() = 0;
 	virtual void reloadGameIfExists() = 0;
 	virtual void saveGame() = 0;
+	/** Keep a journal of the choices made, to continue from after a restart. On unless turned off in the config */
+	virtual void setAutosave(bool value) = 0;
 	static std::shared_ptr<Game> newInstance();
 
 	virtual std::string const className() const override { return "Game"; }
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <vector>
+
+struct ALLEGRO_FONT;
+class Story;
+
+/**
+ * TTF glyphs are rasterized and uploaded the first time they are drawn,
+ * which shows up as a hitch halfway the typewriter animation.
+ * These helpers move that cost to load time.
+ */
+
+/** Add all codepoints that the story can put on screen (TEXT and ANSWER commands) to result */
+void collectCodepoints(const Story &story, std::set<int32_t> &result);
+
+/** Draw every codepoint once with every font, offscreen, so that all glyphs are in the font's cache */
+void prewarmGlyphs(const std::vector<ALLEGRO_FONT*> &fonts, const std::set<int32_t> &codepoints);
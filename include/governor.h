@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Lowers the quality of effects when frames take too long, and raises it again when there is headroom.
+ * <p>
+ * The main loop reports every frame. Once per window of frames, the governor decides:
+ * if too many frames came late, one level down right away.
+ * If the work per frame was well within budget for several windows in a row, one level up.
+ * The gap between the two thresholds keeps it from flip-flopping.
+ */
+class Governor {
+public:
+	struct Level {
+		float particleDensity;
+		float effectScale; // resolution of the effect layer, relative to the screen
+		size_t tileBudget; // bytes
+	};
+
+	/** Frame budget in msec, normally the logic interval */
+	static void setBudget(double msec) { budget = msec; }
+	static void setEnabled(bool value);
+
+	/**
+	 * interval: time since the previous frame started.
+	 * work: time spent on logic updates and drawing for this frame, not counting the wait for vsync.
+	 */
+	static void frame(double interval, double work);
+
+	static int getLevel() { return level; }
+	static const Level &getSettings();
+private:
+	static double budget;
+	static bool enabled;
+	static int level;
+	static int calmWindows;
+	static std::vector<double> intervals;
+	static std::vector<double> works;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <allegro5/allegro.h>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * Recording of the input events that were passed to the app, with the logic tick on which they arrived.
+ * <p>
+ * An event with tick t arrived after t logic updates, before the next one.
+ * Text format, one event per line:
+ * <pre>
+ * twist-input 1 &lt;logic interval msec&gt;
+ * &lt;tick&gt; K &lt;type&gt; &lt;keycode&gt; &lt;unichar&gt; &lt;modifiers&gt; &lt;repeat&gt;
+ * &lt;tick&gt; M &lt;type&gt; &lt;x&gt; &lt;y&gt; &lt;z&gt; &lt;w&gt; &lt;dx&gt; &lt;dy&gt; &lt;dz&gt; &lt;dw&gt; &lt;button&gt;
+ * &lt;tick&gt; T &lt;type&gt; &lt;id&gt; &lt;x&gt; &lt;y&gt; &lt;dx&gt; &lt;dy&gt; &lt;primary&gt;
+ * &lt;tick&gt; R &lt;width&gt; &lt;height&gt;
+ * &lt;tick&gt; E
+ * </pre>
+ * Mouse and touch coordinates are in game coordinates, i.e. after adjustMickey.
+ */
+class InputLog {
+private:
+	std::ofstream out;
+	bool recording;
+
+	std::vector<std::pair<int64_t, ALLEGRO_EVENT>> events;
+	size_t next;
+	int64_t endTick;
+	bool replaying;
+public:
+	InputLog() : out(), recording(false), events(), next(0), endTick(-1), replaying(false) {}
+
+	bool startRecording(const std::string &filename, int logicIntervalMsec);
+	bool isRecording() const { return recording; }
+	void record(int64_t tick, const ALLEGRO_EVENT &event);
+	void stopRecording(int64_t tick);
+
+	/** Returns false if the file can't be read. Warns if it was recorded at a different logic rate */
+	bool load(const std::string &filename, int logicIntervalMsec);
+	bool isReplaying() const { return replaying; }
+	/** Next event that arrived at or before tick, if any */
+	bool pop(int64_t tick, ALLEGRO_EVENT &event);
+	/** All events were replayed */
+	bool isDone() const { return next >= events.size(); }
+	/** Tick on which the recording was stopped */
+	int64_t getEndTick() const { return endTick; }
+};
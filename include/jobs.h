@@ -0,0 +1,107 @@
+#pragma once
+
+#include <allegro5/allegro.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Emitted by JobSystem::getEventSource() when completions are waiting for the main thread */
+const unsigned int TWIST_JOBS_EVENT = ALLEGRO_GET_EVENT_TYPE('T', 'J', 'O', 'B');
+
+/**
+ * Runs work off the main thread, on a small pool of worker threads.
+ * <p>
+ * Every worker has its own queue per priority. Jobs submitted by a worker go to its own queue,
+ * jobs from the main thread are dealt out over the workers. A worker takes the oldest job
+ * of the highest priority it can find: from its own queue first, otherwise stolen from the back of another's.
+ * <p>
+ * A job may have a completion, which runs on the main thread in runCompletions(), once the work is done.
+ * The main loop calls that once per frame, within a time budget. That is the place to use the display
+ * (e.g. upload bitmaps to video memory), and to publish results to the rest of the game.
+ * <p>
+ * A cancelled job isn't started, and its completion doesn't run. Work that is running already
+ * finishes, unless it checks isCancelled() along the way.
+ * <p>
+ * Without threads (emscripten), jobs run from runCompletions() instead, as far as the budget allows.
+ */
+class JobSystem {
+public:
+	enum Priority { HIGH, NORMAL, LOW, PRIORITY_NUM };
+
+	class Job {
+		friend class JobSystem;
+		enum State { QUEUED, RUNNING, COMPLETING, DONE, CANCELLED };
+
+		std::function<void()> work;
+		std::function<void()> completion;
+		Priority priority;
+		uint64_t submitted; // Profiler::now()
+		std::atomic<int> state;
+		std::atomic<bool> cancelled;
+	public:
+		Job(std::function<void()> work, std::function<void()> completion, Priority priority);
+		bool isCancelled() const { return cancelled; }
+		/** The work and the completion have run, or never will */
+		bool isDone() const { return state == DONE || state == CANCELLED; }
+	};
+	typedef std::shared_ptr<Job> Handle;
+private:
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Handle> queues[PRIORITY_NUM];
+	};
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	std::atomic<unsigned int> nextWorker;
+
+	std::atomic<int> queued; // submitted but not yet taken, including cancelled ones
+	std::mutex sleepMutex;
+	std::condition_variable wakeup; // a job was submitted
+	std::condition_variable finished; // a job has stopped running
+	bool quit;
+
+	std::mutex completionMutex;
+	std::deque<Handle> completions;
+	ALLEGRO_EVENT_SOURCE eventSource;
+
+	Handle take(int worker);
+	void run(const Handle &job);
+	void queueCompletion(const Handle &job);
+	void work(int worker);
+public:
+	/** threads: number of workers, 0 for one less than there are cores (at most 4) */
+	explicit JobSystem(int threads = 0);
+	JobSystem(const JobSystem &) = delete;
+	JobSystem &operator=(const JobSystem &) = delete;
+	~JobSystem();
+
+	/** Can be called from any thread, including from a job */
+	Handle submit(std::function<void()> work, Priority priority = NORMAL, std::function<void()> completion = nullptr);
+
+	/** Any thread. See the class comment */
+	void cancel(const Handle &job);
+	/** For work that takes a while: whether the job it runs in was cancelled, so it can stop early */
+	static bool isCurrentCancelled();
+	/**
+	 * Block until the work of a job has run or was cancelled. Not for use from a job.
+	 * Without threads, this runs the queue (and the completions in it) up to the job.
+	 */
+	void wait(const Handle &job);
+
+	struct CompletionResult {
+		int ran; // completions, and without threads also jobs
+		bool pending; // more are waiting, the budget ran out
+	};
+	/** Run waiting completions, on the main thread. At least one runs, then more until budget msec are used */
+	CompletionResult runCompletions(double budget);
+
+	/** Jobs waiting for a worker */
+	int getQueueDepth() const { return queued; }
+	ALLEGRO_EVENT_SOURCE *getEventSource() { return &eventSource; }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Autosave: every answer the player picks is appended to a file, as soon as it is picked.
+ * <p>
+ * The file starts with a snapshot (a SaveGame encoding, with the answers on offer),
+ * followed by a record per choice since then: the number of the answer, the line of its
+ * ANSWER command (to check that the replay takes the same path), and a check byte.
+ * Appending is a few bytes and a flush. A record cut short by a crash is ignored when reading.
+ * <p>
+ * start() and compact() only change what is in memory, write() puts it in the file:
+ * a new file is written and flushed to disk without holding the lock, then renamed over
+ * the old one, and the records appended in the meantime are added. Meant for a background
+ * job, appending stays cheap meanwhile. Until then appends go to the old file after a
+ * compaction, after a start they are only kept in memory.
+ */
+class Journal {
+public:
+	struct Choice {
+		int index; // in the answers on offer
+		int lineno; // of the ANSWER command
+	};
+private:
+	std::mutex fileMutex; // one write() at a time
+	std::mutex lockMutex; // guards everything below
+	std::string path;
+	FILE *file;
+	std::string snapshot;
+	std::vector<std::string> records; // since the snapshot
+	size_t base; // number of choices before records[0]
+	uint64_t epoch; // changes with the snapshot
+
+	static std::string encode(const std::string &snapshot);
+public:
+	explicit Journal(const std::string &path);
+	Journal(const Journal &) = delete;
+	Journal &operator=(const Journal &) = delete;
+	~Journal();
+
+	static std::string getDefaultPath();
+
+	/** Start over from a snapshot, counting choices from first. In the file after write() */
+	void start(const std::string &snapshot, size_t first = 0);
+	void append(const Choice &choice);
+	/** For compact() */
+	uint64_t getEpoch();
+	/** Choices appended since start() */
+	size_t getChoiceCount();
+	/** Records in the file, after its snapshot */
+	size_t getRecordCount();
+
+	/**
+	 * Replace the snapshot by a later one, taken before choice number first.
+	 * Records of earlier choices are dropped. Can be called from any thread.
+	 * Returns false if start() or another compact() came since getEpoch() returned epoch.
+	 */
+	bool compact(const std::string &snapshot, size_t first, uint64_t epoch);
+
+	/**
+	 * Write the snapshot and records to the file, replacing it atomically. Can be called
+	 * from any thread. Returns false if that failed: the old file is kept, if there is one.
+	 */
+	bool write();
+
+	/** Read the file: snapshot and choices. Returns false if there is no valid snapshot */
+	bool read(std::string &snapshot, std::vector<Choice> &choices);
+
+	void close();
+};
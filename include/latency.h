@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Measures how long it takes from the input that makes a choice,
+ * until the first glyph (or image) of the response is on screen.
+ * <p>
+ * The time is broken down into stages. Time spent in nested stages is only counted for the innermost one.
+ * Whatever isn't in a stage is waiting: for the next logic tick, the reveal, or the next frame.
+ * <p>
+ * Everything is on the display thread, no locking.
+ */
+class Latency {
+public:
+	enum Stage { WAIT = 0, INTERPRET, LAYOUT, ASSETS, PRESENT, STAGE_NUM };
+
+	/** Input arrived, with its al_get_time() timestamp, or 0 if unknown. A choice made while handling it is timed from then */
+	static void input(double timestamp);
+	static void inputDone();
+
+	/** The player made a choice: start timing */
+	static void choice();
+	/** Switch to another stage, returns the previous one */
+	static Stage enter(Stage stage);
+	/** The first part of the response appeared, it'll be shown by the next frame */
+	static void shown();
+	/** A frame was presented. Logs the latency of a choice if verbose, or if it was slow */
+	static void presented(bool verbose);
+
+	/** Total of the last completed choice in msec, or -1 if none */
+	static double getLast() { return last; }
+private:
+	static double last;
+};
+
+class LatencyScope {
+private:
+	Latency::Stage prev;
+public:
+	LatencyScope(Latency::Stage stage) : prev(Latency::enter(stage)) {}
+	LatencyScope(const LatencyScope &) = delete;
+	LatencyScope &operator=(const LatencyScope &) = delete;
+	~LatencyScope() { Latency::enter(prev); }
+};
@@ -6,22 +6,20 @@
 #include <memory>
 #include <vector>
 #include <map>
+#include "varmap.h"
 
 struct ALLEGRO_COLOR;
 
 class SimpleState
 {
 public:
-	std::map<std::string, int> gameVariables;
+	VarMap gameVariables; // cheap to copy, see VarMap
 	std::string currentNodeName;
 
 	bool hasVar (const std::string &key) const
 	{
-		return gameVariables.find (key) != gameVariables.end();
+		return gameVariables.has (key);
 	}
-
-	void save();
-	bool load();
 };
 
 enum CommandType {
@@ -109,6 +107,7 @@ class Answer
 public:
 	std::string text;
 	std::vector<Command> commands;
+	int lineno = 0; // of the ANSWER command, which identifies the answer in saves
 };
 
 /** Runs commands and evaluates boolean expressions*/
@@ -124,6 +123,8 @@ public:
 	virtual void executeStatements(SimpleState &sstate, std::vector<Answer> &answerResult, std::vector<Command>::iterator &i, std::vector<Command>::iterator end) = 0;
 
 	virtual Answer executeAnswer(SimpleState &sstate, std::vector<Command>::iterator &i, std::vector<Command>::iterator end) = 0;;
+	/** The answer of the ANSWER command on line lineno, as executeAnswer would give it. False if there is none */
+	virtual bool findAnswer(SimpleState &sstate, int lineno, Answer &result) = 0;
 
 	static std::unique_ptr<Interpreter> build(StatementHandler *handler, Story &story);
 };
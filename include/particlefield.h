@@ -0,0 +1,80 @@
+#pragma once
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_primitives.h>
+#include <cstdint>
+#include <vector>
+#include "component.h"
+
+/**
+ * Full screen particle effects, for the EFFECT command.
+ * <p>
+ * Particles are stored as structure of arrays, in a pool that is allocated once,
+ * so switching effects doesn't allocate. The update is one pass over the arrays
+ * (SSE where available), and all particles are drawn with a single al_draw_indexed_prim.
+ */
+class ParticleField : public Component {
+public:
+	enum Effect { CLEAR, SNOW, STARS, METEOR, ANTIGRAV, CONFETTI, WIND, POW, VORTEX };
+
+	/** What an effect spawns, and the forces that act on it */
+	struct Params {
+		float rate; // particles per second, at 640x480
+		int burst; // spawned at once when the effect starts
+		float gravity; // px/s^2, downwards
+		float wind; // px/s^2, to the right
+		float gust; // amplitude of the wind variation
+		float swirl; // px/s^2, around the center
+		float pull; // px/s^2, towards the center
+		float life; // seconds
+		float size; // px
+		const ALLEGRO_COLOR *palette;
+		int paletteSize;
+	};
+private:
+	// one entry per particle. Padded to a multiple of 4, so the update can always go 4 at a time.
+	std::vector<float> px, py, vx, vy, life, size;
+	std::vector<ALLEGRO_COLOR> color;
+	size_t count;
+	size_t capacity;
+
+	std::vector<ALLEGRO_VERTEX> vertices;
+	std::vector<int> indices;
+
+	Effect effect;
+	const Params *params;
+	float density; // multiplier for the number of particles
+	float effectScale; // resolution of the layer the particles are drawn on
+	float pixelScale; // sizes, speeds and forces are multiplied by this
+	ALLEGRO_BITMAP *layer; // only used at reduced resolution
+	float spawnDebt; // fraction of a particle still to spawn
+	float time; // since the effect started
+	uint32_t seed;
+
+	float random(); // in [0, 1)
+	float random(float lo, float hi) { return lo + (hi - lo) * random(); }
+	void spawn(int n);
+	void spawnOne();
+	void integrate(float dt, float ax, float ay, float swirl, float pull, float cx, float cy);
+	void removeDead();
+public:
+	ParticleField(size_t capacity = 16384);
+
+	void setEffect(Effect value);
+	/** Scale the number of particles, e.g. to keep up on slow machines. 1.0 is the designed amount */
+	void setDensity(float value) { density = value; }
+	float getDensity() const { return density; }
+	/** Below 1.0, particles are drawn at reduced resolution and scaled up, to save fill rate */
+	void setEffectScale(float value) { effectScale = value; }
+	/** When drawing at native resolution, to make the effects look the same as at the logical size */
+	void setPixelScale(float value) { pixelScale = value; }
+	size_t getCount() const { return count; }
+	/** nothing moving: the effect is cleared and all particles are gone */
+	bool isIdle() const { return effect == CLEAR && count == 0; }
+
+	virtual void update() override;
+	virtual void draw(const GraphicsContext &gc) override;
+	ParticleField(const ParticleField &) = delete;
+	ParticleField &operator=(const ParticleField &) = delete;
+	virtual ~ParticleField();
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Timing of named phases, with low enough overhead to leave on in release builds.
+ * <p>
+ * Each thread records its events in its own ring buffer, recording never takes a lock.
+ * Per phase, durations are also counted in a log-scale histogram, from which percentiles are estimated.
+ * <p>
+ * Phase names are compared by pointer, so they must be string literals.
+ */
+class Profiler {
+public:
+	static const int MAX_PHASES = 32;
+	static const int BUCKETS = 128; // 4 per power of two, up to about 4 seconds
+	static const size_t RING_SIZE = 8192; // events kept per thread
+
+	/** nanoseconds since the first call */
+	static uint64_t now();
+	static void record(const char *phase, uint64_t start, uint64_t end);
+
+	/** Start a new reporting window. Percentiles are over the last complete window */
+	static void nextWindow();
+	/** Estimated duration in msec of percentile p (0..100) in the last window, or -1 if the phase didn't occur */
+	static double percentile(const char *phase, double p);
+	/** Phases in order of first occurrence */
+	static std::vector<const char *> getPhases();
+
+	/**
+	 * Write the events still in the ring buffers in Chrome trace event format,
+	 * to be loaded in chrome://tracing or Perfetto. Returns false on failure
+	 */
+	static bool exportTrace(const std::string &filename);
+};
+
+class ProfileScope {
+private:
+	const char *phase;
+	uint64_t start;
+public:
+	ProfileScope(const char *phase) : phase(phase), start(Profiler::now()) {}
+	ProfileScope(const ProfileScope &) = delete;
+	ProfileScope &operator=(const ProfileScope &) = delete;
+	~ProfileScope() { Profiler::record(phase, start, Profiler::now()); }
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+/** Time the rest of the enclosing block as the given phase */
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_CONCAT(profileScope, __LINE__) (phase)
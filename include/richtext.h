@@ -1,11 +1,7 @@
 #pragma once
 
 #include <allegro5/allegro_color.h>
-#include <list>
-#include <memory>
-
-class Component;
-typedef std::shared_ptr<Component> ComponentPtr;
+#include "segmentstore.h"
 
 struct ALLEGRO_FONT;
 
@@ -15,4 +11,4 @@ struct StyleData {
 	ALLEGRO_FONT *normal, *header, *bold, *italic;
 };
 
-void appendRichText(const char *s, float *xflow, float *yflow, int iw, std::list<ComponentPtr> &components, const StyleData &style);
+void appendRichText(const char *s, float *xflow, float *yflow, int iw, SegmentStore &segments, const StyleData &style);
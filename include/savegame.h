@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class SimpleState;
+class Story;
+
+/**
+ * Binary save games.
+ * <p>
+ * Layout: magic "TWSV", version, hash of the story, node id, number of variables, the variables,
+ * the answers on offer (by the line of their ANSWER command), and a CRC-32 of everything before it.
+ * Fixed size numbers are little endian; lengths, counts, lines and the variable values are varints
+ * (values zigzag encoded), strings are a length followed by the bytes.
+ * <p>
+ * Files are written to a temporary file, flushed to disk and renamed over the old one,
+ * so after a crash there is either the old save or the new one, never a mix.
+ */
+class SaveGame {
+public:
+	static const uint32_t VERSION = 2;
+
+	/** Of the flags and node ids. A save from a story with other nodes or flags isn't loaded */
+	static uint32_t hashStory(const Story &story);
+
+	static std::string encode(const SimpleState &state, const std::vector<int> &answers, uint32_t storyHash);
+	/** Returns false, leaving state and answers as they were, if data isn't a complete save of this story */
+	static bool decode(const std::string &data, uint32_t storyHash, SimpleState &state, std::vector<int> &answers);
+
+	static std::string getPath();
+	static bool exists();
+	/** Number a save, on the thread that takes it. Later saves get higher numbers */
+	static uint64_t newGeneration();
+	/**
+	 * Atomically replace the save file. Can be called from any thread. Returns false on failure.
+	 * A save older than the generation already written is skipped, however the writes are scheduled.
+	 */
+	static bool write(const std::string &data, uint64_t generation);
+	/** Read and validate the save file. Without one, a text save of an earlier version is converted */
+	static bool load(uint32_t storyHash, SimpleState &state);
+	/** The text save of earlier versions. Returns false, leaving state as it was, if it isn't one */
+	static bool decodeLegacy(std::istream &in, SimpleState &state);
+
+	/** Write to a temporary file, flush it to disk, and rename it over path */
+	static bool writeFile(const std::string &path, const std::string &data);
+	/** The steps of writeFile: write and flush to disk, and rename replacing the target. Not serialized with saves */
+	static bool writeSynced(const std::string &path, const std::string &data);
+	static bool moveFile(const std::string &from, const std::string &to);
+	static bool readFile(const std::string &path, std::string &data);
+
+	static uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+};
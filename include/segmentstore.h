@@ -0,0 +1,83 @@
+#pragma once
+
+#include <allegro5/allegro.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct ALLEGRO_FONT;
+
+/**
+ * A run of text or an image, in canvas coordinates.
+ * Plain data, so that segments can be stored contiguously and copied without refcounting.
+ */
+struct Segment {
+	enum Type : uint8_t { TEXT, LINK, IMAGE };
+
+	Type type;
+	int x, y, w, h;
+	ALLEGRO_COLOR color;
+	union {
+		ALLEGRO_FONT *font; // TEXT and LINK
+		ALLEGRO_BITMAP *bmp; // IMAGE
+	};
+	uint32_t textStart; // offset in the text arena of the store
+	uint32_t textLen; // in bytes, 0 for images
+	int32_t link; // index of the click handler, LINK only
+	uint32_t glyphStart; // offset in the glyph arena of the store
+	uint32_t glyphCount; // 1 for images, which appear at once
+
+	bool contains(int xx, int yy) const { return xx >= x && yy >= y && xx < x + w && yy < y + h; }
+};
+
+/**
+ * Contiguous storage for segments, in the order they were appended.
+ * <p>
+ * The text of all segments is kept in a single arena, and only links carry a callback.
+ * Layout also records where each glyph ends, so that a partially revealed segment
+ * can be drawn without measuring its text again.
+ * Segments can only be removed from the front, the space is reclaimed in bulk
+ * once more than half of the storage is unused.
+ */
+class SegmentStore {
+private:
+	std::vector<Segment> segments;
+	size_t head; // index of the first live segment
+	std::string text;
+	std::vector<std::function<void()>> links;
+	std::vector<int> glyphX; // right edge of each glyph, relative to the segment
+
+	Segment &add(Segment::Type type, int x, int y, int w, int h);
+	void compact();
+public:
+	SegmentStore() : segments(), head(0), text(), links(), glyphX() {}
+
+	size_t size() const { return segments.size() - head; }
+	bool empty() const { return size() == 0; }
+	Segment &operator[](size_t i) { return segments[head + i]; }
+	const Segment &operator[](size_t i) const { return segments[head + i]; }
+	const Segment &front() const { return segments[head]; }
+	const Segment *begin() const { return segments.data() + head; }
+	const Segment *end() const { return segments.data() + segments.size(); }
+
+	void popFront();
+	void clear();
+
+	/** Index of the first segment that could overlap canvas y coordinate yy, or anything below it. None may be taller than maxHeight */
+	size_t firstOverlapping(int yy, int maxHeight) const;
+
+	Segment &addText(int x, int y, ALLEGRO_FONT *font, ALLEGRO_COLOR color, const char *s, size_t len);
+	Segment &addLink(int x, int y, ALLEGRO_FONT *font, ALLEGRO_COLOR color, const char *s, size_t len, const std::function<void()> &onClick);
+	Segment &addImage(int x, int y, ALLEGRO_BITMAP *bmp);
+
+	const char *getText(const Segment &seg) const { return text.data() + seg.textStart; }
+	void click(const Segment &seg) const;
+
+	/** Width of the first n glyphs of a segment */
+	int getGlyphRight(const Segment &seg, size_t n) const;
+
+	/** Draw a segment offset by (xofst, yofst). Only the first glyphs are drawn, by clipping the rest. */
+	void draw(const Segment &seg, int xofst, int yofst, size_t glyphs) const;
+	void draw(const Segment &seg, int xofst, int yofst) const { draw(seg, xofst, yofst, seg.glyphCount); }
+};
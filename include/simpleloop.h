@@ -8,12 +8,10 @@
 #include <string>
 #include <vector>
 #include <map>
-#include "point.h"
-
-#ifdef USE_MONITORING
 #include <chrono>
-typedef std::chrono::high_resolution_clock Clock;
-#endif
+#include "point.h"
+#include "inputlog.h"
+#include "jobs.h"
 
 /**
  * Equivalent of mainLoop->getw().
@@ -40,22 +38,40 @@ typedef std::chrono::high_resolution_clock Clock;
 
 namespace Simple {
 
+/**
+ * Result of IApp::update().
+ * UPDATE_IDLE means that nothing visible changed, and nothing will change until the next input event.
+ * The main loop then skips drawing, and stops the logic timer until input arrives.
+ */
+enum UpdateResult { UPDATE_QUIT = 0, UPDATE_IDLE, UPDATE_REDRAW };
+
 class IApp {
 public:
 	virtual void handleEvent(ALLEGRO_EVENT &evt) = 0;
-	virtual bool update() = 0;
+	virtual UpdateResult update() = 0;
 	virtual void draw(const GraphicsContext &gc) = 0;
 };
 
 class MainLoop final : public Component, public ITimer
 {
+public:
+	/**
+	 * How the logical screen gets to the display, when they differ in size.
+	 * BLIT: draw to an offscreen buffer of the logical size, and scale that to the backbuffer.
+	 * TRANSFORM: draw directly to the backbuffer, with a scaling ALLEGRO_TRANSFORM.
+	 * NATIVE: no scaling at all. The app lays out for the full display, drawing fonts and spacing getScale() times larger.
+	 *    Only for apps that don't use a fixed resolution, the others get BLIT.
+	 */
+	enum Scaling { SCALING_BLIT = 0, SCALING_TRANSFORM, SCALING_NATIVE, SCALING_NUM };
 private:
-	ALLEGRO_BITMAP *buffer;
+	ALLEGRO_BITMAP *buffer; // what the app draws to
+	ALLEGRO_BITMAP *screen; // what is shown: the backbuffer, or the benchmark target
 	ALLEGRO_EVENT_QUEUE *equeue;
 	ALLEGRO_TIMER *logicTimer;
 	ALLEGRO_DISPLAY *display;
 
 	std::unique_ptr<Audio> _audio = nullptr;
+	std::unique_ptr<JobSystem> jobs;
 	std::shared_ptr<IApp> app;
 	
 	ALLEGRO_PATH *localAppData;
@@ -85,9 +101,16 @@ private:
 	 */
 	Point prefDisplaySize;
 
-	// indicates whether buffer size is different from display size
+	// indicates whether logical size (w, h) is different from display size
 	bool stretch;
 
+	// twist/scaling in the config, or -scaling
+	Scaling scaling = SCALING_BLIT;
+	int scale = 1;
+	/** Sets up buffer for drawing w x h to the screen, with the chosen scaling. Returns 0 on failure */
+	int initScaling();
+	void useScalingTransform();
+
 	// If useFixedResolution is on, the buffer will be the same size as w, h.
 	// if useFixedResolution is off, the buffer can be any size, but w, h will be used as the default window size if there is that flexibility.
 	// this could also be described as responsive mode.
@@ -117,22 +140,57 @@ private:
 	int initDisplay();
 
 	std::vector<std::string> options;
-#ifdef USE_MONITORING
-	Clock::time_point t0; // time since start of program
-	Clock::time_point t1; // time since start of update loop
-	Clock::time_point t2; // time since start of phase
-	void logStartTime(const std::string &phase);
-	void logEndTime(const std::string &phase);
-	std::map<std::string, long> sums;
-	std::map<std::string, int> counts;
-#endif
+
+	// time to first frame, broken down by phase
+	std::chrono::steady_clock::time_point startupBegin;
+	std::vector<std::pair<std::string, double>> startupPhases; // name, msec since previous phase
+	std::chrono::steady_clock::time_point startupLast;
+	bool firstFrameDone = false;
+	void reportStartup();
+
+	// -benchmark: no window. Renders a fixed number of frames to a memory bitmap,
+	// with one logic tick per frame, as fast as possible.
+	// With -benchdisplay, to the display instead, without waiting for vsync. This is the one to compare scaling on.
+	bool benchmark = false;
+	bool benchDisplay = false;
+	int benchFrames = -1; // 600, or until the replay ends
+	Point benchSize = Point(640, 480);
+	int benchScale = 1; // the screen is this much larger than the logical size, like the display would be
+	int initBenchmark();
+	void runBenchmark();
+
+	// -record / -replay: input events and the tick on which they arrived
+	std::string recordFile;
+	std::string replayFile;
+	InputLog inputLog;
+	void replayInput();
+	void replayEvent(ALLEGRO_EVENT &event);
+	void logicUpdate();
+
+	// measured for the Governor
+	std::chrono::steady_clock::time_point lastFrameStart;
+	double frameWork = 0; // msec of logic updates since the last frame
+
+	// logic timer is stopped while the app is idle
+	bool idle = false;
+	void wake();
+
+	void drawProfile(int yy);
+	/** F9 writes recent profiler events to trace.json in the settings directory */
+	void exportTrace();
 protected:
 	ALLEGRO_CONFIG *config;
 	bool fpsOn;
 
-	void pumpMessages();
+	bool needRedraw = true;
+	bool quit = false;
+	void dispatchEvent(ALLEGRO_EVENT &event);
+	void runCompletions();
+	void drawFrame();
 public:
 	bool isSmokeTest() { return smokeTest; }
+	/** Benchmark or replay: input doesn't come from the player */
+	bool isScripted() { return benchmark || !replayFile.empty(); }
 
 	// randomly generated id used to identify recurring user
 	std::string getUserId();
@@ -147,12 +205,26 @@ public:
 		}
 	}
 
+	/** Multiplier for font sizes and layout. Only above 1 with native scaling, the others scale for the app */
+	int getScale() { return scale; }
+	Scaling getScaling() { return scaling; }
+	static const char *getScalingName(Scaling value);
+
 	/** return vector of unhandled command-line arguments */
 	std::vector<std::string> &getOpts() { return options; }
 
 	ALLEGRO_CONFIG *getConfig() { return config; }
 	
 	int getMsecCounter () { return al_get_timer_count(logicTimer) * logicIntervalMsec; }
+
+	/** Seconds, like al_get_time(). In benchmark mode, time only advances with the logic ticks */
+	double getTime();
+
+	/**
+	 * Mark the end of a startup phase. The phases are reported
+	 * together with the time to first frame, once the first frame is shown.
+	 */
+	void traceStartup(const std::string &phase);
 	void setFpsOn (bool value) { fpsOn = value; }
 
 	MainLoop (Component *_engine, const char *configFilename, const char *title, int _bufw = 640, int _bufh = 480);
@@ -202,7 +274,20 @@ public:
 	 * returns 0 on success, 1 on failure
 	 */
 	int init(int argc, const char *const *argv);
-	void run();	
+
+	/** Runs the game until it quits. Built on start(), tick() and shutdown() */
+	void run();
+
+	/**
+	 * For hosts that drive the loop themselves: call start() once,
+	 * then tick() until it returns false, then shutdown().
+	 * tick() handles all pending events (running the logic update for each timer event),
+	 * and draws at most one frame. It never blocks.
+	 */
+	void start();
+	bool tick();
+	void shutdown();
+
 	virtual ~MainLoop();
 	
 	virtual void parseOpts(std::vector<std::string> &opts) {};
@@ -212,6 +297,8 @@ public:
 	bool isWindowed();
 
 	Audio *audio() { return _audio.get(); }
+	/** Background work. Completions run once per tick, and wake the loop when it is idle */
+	JobSystem &getJobs() { return *jobs; }
 	static MainLoop *getMainLoop();
 };
 
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Engine counters, sampled once per frame.
+ * <p>
+ * Per-frame counters (e.g. draw calls) are added to while a frame is made, and start from zero for the next.
+ * The others are levels (e.g. bitmaps resident) that keep the last value set.
+ * All counters can be updated from any thread.
+ * Allocations are only counted in builds with TWIST_ALLOC_STATS defined.
+ */
+class Stats {
+public:
+	enum Counter {
+		DRAW_CALLS, GLYPHS, SEGMENTS, PARTICLES, BITMAPS, BITMAP_BYTES, ALLOCS, ALLOC_BYTES, COMMANDS, JOBS_QUEUED, JOBS_DONE,
+		COUNTER_NUM
+	};
+
+	static void add(Counter counter, int64_t n = 1);
+	static void set(Counter counter, int64_t value);
+	/** Value of the last complete frame */
+	static int64_t get(Counter counter);
+	static const char *getName(Counter counter);
+
+	/** Sample all counters, and write them to the CSV file if one is open */
+	static void endFrame();
+
+	/** Write a line per frame from now on. Returns false if the file can't be created */
+	static bool openCsv(const std::string &filename);
+	static void closeCsv();
+};
@@ -2,61 +2,114 @@
 #define COMPONENT2_H
 
 #include <vector>
-#include <list>
 #include <string>
 #include <allegro5/allegro.h>
 #include "color.h"
 #include "component.h"
 #include "widget.h"
 #include "richtext.h"
+#include "tilecache.h"
+#include "segmentstore.h"
+#include "transcript.h"
+#include "assets.h"
+#include <memory>
 
 struct ALLEGRO_FONT;
 struct ALLEGRO_SAMPLE;
 
-class ImageSegment : public Component {
-	ALLEGRO_BITMAP *bmp;
-public:
-	ImageSegment(ALLEGRO_BITMAP *bmp) : bmp(bmp)
-	{
-		setVisible(false);
-		setFont(NULL);
-	}
-
-	virtual void draw(const GraphicsContext &gc) override;
-};
-
 class TextCanvas : public Component {
 private:
 	int busy;
-	std::list<ComponentPtr> lines;
-	std::list<ComponentPtr>::iterator cursor;
+
+	// everything that was appended, in compact form. Can be scrolled back to.
+	Transcript transcript;
+	std::shared_ptr<Assets> assets; // images are looked up by id
+
+	// laid out segments of transcript entries [matFirst, matLast), ordered by y.
+	// In follow mode, matLast is always the end of the transcript.
+	SegmentStore lines;
+	size_t matFirst;
+	size_t matLast;
+	size_t matSegBase; // transcript-wide index of lines[0]
+	size_t segTotal; // transcript-wide index of the next segment
+
+	// transcript-wide index of the first segment that hasn't completely appeared yet,
+	// of which the first cursorGlyphs are showing.
+	size_t revealed;
+	size_t revealEntry; // entry that contains it
+	size_t cursorGlyphs;
+	double revealSpeed; // glyphs per second
+	double revealBudget; // glyphs that may appear, but haven't yet
+	double lastUpdateTime;
+
 	ALLEGRO_COLOR activeColor; // color used for appending.
 	ALLEGRO_FONT *activeFont; // font used for appending
 	StyleData style;
 	int xco;
 	int yco;
-	int yoffset;
+	int yoffset; // scroll position of the view
+	int tailOffset; // scroll position that keeps up with the end of the text
 	int scrollSpeed;
-	bool waitForAnimationDone; // signal that we are waiting for a segment to finish appearing
-	void carriageReturn();
-	void startAnimationAtCursor();
+
+	// finished paragraphs are drawn from cached tiles, only segments below sealedY are drawn glyph by glyph.
+	TileCache tileCache;
+	int sealedY; // canvas y above which no segment will change anymore
+	int maxSegmentHeight; // used to find segments that overlap a band from above
+	int maxLineHeight;
+	int contentWidth; // may be wider than w, e.g. for images
+
+	void carriageReturn(ALLEGRO_FONT *font);
+	void advanceCursor(double elapsed);
+	void seal(int yy) { if (yy < sealedY) sealedY = yy; }
+	void growSegmentHeight(int hh) { if (hh > maxSegmentHeight) maxSegmentHeight = hh; }
+	void growLineHeight(int hh) { growSegmentHeight(hh); if (hh > maxLineHeight) maxLineHeight = hh; }
+	void drawSegments(int top, int bottom, int xofst, int yofst);
+	size_t firstOverlapping(int yy);
+
+	bool isFollowing() const { return yoffset == tailOffset; }
+	void layoutPlain(const std::string &line, ALLEGRO_COLOR color, ALLEGRO_FONT *font);
+	void layout(const TranscriptEntry &entry);
+	void addEntry(TranscriptEntry entry);
+	void rebuild(size_t first, size_t last);
+	void materialize(int top, int bottom);
+	void prune();
+	void dropFront();
+	void releaseImages();
 public:
 	bool isBusy() { return busy != 0; }
 	bool speedUp;
-	TextCanvas() : busy(0), lines(), cursor(lines.begin()), activeColor(WHITE), activeFont(NULL), xco(0), yco(0), yoffset(0), scrollSpeed(2), waitForAnimationDone(false), speedUp(false) {}
+	TextCanvas() : busy(0), transcript(), assets(), lines(), matFirst(0), matLast(0), matSegBase(0), segTotal(0), revealed(0), revealEntry(0), cursorGlyphs(0),
+		revealSpeed(50), revealBudget(0), lastUpdateTime(-1),
+		activeColor(WHITE), activeFont(NULL), xco(0), yco(0), yoffset(0), tailOffset(0), scrollSpeed(2),
+		tileCache(), sealedY(0), maxSegmentHeight(0), maxLineHeight(0), contentWidth(0), speedUp(false) {}
 	void appendLine (const std::string &line);
 	void append (const std::string &line, ALLEGRO_COLOR color);
-	void appendImage (ALLEGRO_BITMAP *img);
+	void appendImage (const std::string &id);
 	void appendRich(const std::string &line);
 	void setActiveColor(ALLEGRO_COLOR color);
-	void setActiveFont(ALLEGRO_FONT *font) { assert (font != NULL); activeFont = font; }
+	void setActiveFont(ALLEGRO_FONT *font);
 	void setStyle(const StyleData &style);
+	void setAssets(std::shared_ptr<Assets> value) { assets = value; }
 	void clear();
-	ComponentPtr getComponentAt(int x, int y);
-	virtual void handleMessage(ComponentPtr src, int msg) override;
+	/** Everything appended so far. Text appended later can be removed again with truncate() */
+	size_t getPosition() const { return transcript.end(); }
+	/** Remove what was appended after getPosition() returned pos. If that was forgotten already, everything is removed */
+	void truncate(size_t pos);
+	void setRevealSpeed(double glyphsPerSec) { revealSpeed = glyphsPerSec; }
+
+	/** Scroll back (dy < 0) through the transcript, or forward again. Appearing text waits while scrolled back. */
+	void scrollBy(int dy);
+	void scrollToEnd() { scrollBy(tailOffset - yoffset); }
+	/** Approximate memory use of the transcript, beyond which the oldest text is forgotten */
+	void setScrollbackLimit(size_t bytes) { transcript.setLimit(bytes); }
+	/** Memory for cached tiles of finished text */
+	void setTileBudget(size_t bytes) { tileCache.setBudget(bytes); }
+
+	/** trigger the link at the given position, if any. Returns true if a link was clicked */
+	bool clickAt(int x, int y);
 	virtual void draw(const GraphicsContext &gc) override;
 	virtual void update() override;
-	virtual ~TextCanvas() {}
+	virtual ~TextCanvas();
 };
 
 #endif
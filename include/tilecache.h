@@ -0,0 +1,60 @@
+#pragma once
+
+#include <allegro5/allegro.h>
+#include <functional>
+#include <map>
+
+/**
+ * Caches horizontal bands of a vertically scrolling canvas as bitmaps.
+ * <p>
+ * Tile i covers canvas coordinates [i * tileHeight, (i+1) * tileHeight).
+ * A tile may only be cached once its content is final, i.e. when it lies
+ * entirely above the "sealed" line passed to draw().
+ * <p>
+ * The total size of all tiles is kept below a memory budget. Tiles more than a view's height
+ * above the view are evicted first, then least recently used ones. The margin keeps the tiles
+ * that scrolling back up a little needs again right away.
+ */
+class TileCache {
+public:
+	/** Render the canvas band [top, bottom) with canvas y == top at target y == 0 */
+	typedef std::function<void(int top, int bottom)> RenderFunc;
+private:
+	struct Tile {
+		ALLEGRO_BITMAP *bmp;
+		int lastUsed; // frame number
+	};
+
+	std::map<int, Tile> tiles; // by index
+	int tileWidth;
+	int tileHeight;
+	size_t budget; // in bytes
+	int frame;
+
+	size_t tileBytes() const { return (size_t)tileWidth * tileHeight * 4; }
+	Tile *find(int index);
+	Tile *create(int index, const RenderFunc &render);
+	void evictAbove(int index);
+	bool makeRoom();
+public:
+	TileCache(int tileHeight = 128, size_t budget = 16 << 20) : tiles(), tileWidth(0), tileHeight(tileHeight), budget(budget), frame(0) {}
+	TileCache(const TileCache &) = delete;
+	TileCache &operator=(const TileCache &) = delete;
+	~TileCache() { clear(); }
+
+	/** Changing the width invalidates all tiles */
+	void setWidth(int w);
+	void setBudget(size_t bytes) { budget = bytes; }
+	int getTileHeight() const { return tileHeight; }
+	size_t getBytesUsed() const { return tiles.size() * tileBytes(); }
+	void clear();
+
+	/**
+	 * Draw the sealed part of canvas band [top, bottom) from the cache, rendering missing tiles on demand.
+	 * (originx, originy) is the target position of canvas coordinate (0, 0).
+	 *
+	 * Returns the canvas y up to which the band was covered by tiles.
+	 * Everything from there to bottom must be drawn directly by the caller.
+	 */
+	int draw(int top, int bottom, int sealed, int originx, int originy, const RenderFunc &render);
+};
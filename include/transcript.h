@@ -0,0 +1,76 @@
+#pragma once
+
+#include <allegro5/allegro.h>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct ALLEGRO_FONT;
+
+/**
+ * One call to TextCanvas::append..., remembered in a form that can be laid out again.
+ * Text is referenced by id, identical text (e.g. from revisiting a node) is stored only once.
+ */
+struct TranscriptEntry {
+	enum Kind : uint8_t { PLAIN, RICH, IMAGE };
+
+	Kind kind;
+	uint32_t source; // id of the text, or of the image asset
+	ALLEGRO_COLOR color; // PLAIN only
+	ALLEGRO_FONT *font; // PLAIN only
+	int x, y; // flow position where layout starts
+	int bottom; // lowest canvas y covered by the laid out segments
+	uint32_t segStart; // transcript-wide index of the first segment
+	uint32_t segCount;
+};
+
+/**
+ * Everything that was appended to a TextCanvas, in compact form.
+ * <p>
+ * Entries are addressed by a transcript-wide index, that stays the same when old entries are dropped.
+ * The oldest entries are dropped once the estimated memory use goes over the limit.
+ */
+class Transcript {
+private:
+	std::deque<TranscriptEntry> entries;
+	size_t base; // number of entries dropped from the front
+
+	// interned text. deque, so the string_view keys stay valid when growing.
+	std::deque<std::string> sources;
+	std::vector<uint32_t> refs;
+	std::vector<uint32_t> freeIds;
+	std::unordered_map<std::string_view, uint32_t> ids;
+
+	size_t sourceBytes;
+	size_t limit;
+	int maxHeight; // of a single entry, used to search entries overlapping a given y
+
+	void release(uint32_t id);
+public:
+	Transcript() : entries(), base(0), sources(), refs(), freeIds(), ids(), sourceBytes(0), limit(1 << 20), maxHeight(0) {}
+
+	uint32_t intern(const std::string &text);
+	const std::string &getSource(uint32_t id) const { return sources[id]; }
+
+	size_t begin() const { return base; }
+	size_t end() const { return base + entries.size(); }
+	bool empty() const { return entries.empty(); }
+	TranscriptEntry &operator[](size_t i) { return entries[i - base]; }
+	const TranscriptEntry &operator[](size_t i) const { return entries[i - base]; }
+
+	/** Add an entry, after it has been laid out */
+	void push(const TranscriptEntry &entry);
+	void popFront();
+	void popBack();
+	void clear();
+
+	/** index of the first entry that could overlap canvas y coordinate yy, or anything below it */
+	size_t firstOverlapping(int yy) const;
+
+	size_t getBytes() const;
+	void setLimit(size_t bytes) { limit = bytes; }
+	bool isOverLimit() const { return getBytes() > limit; }
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/**
+ * Game variables by name, as a persistent map.
+ * <p>
+ * A balanced tree whose nodes are never changed once built. Setting a variable copies
+ * only the path down to it, the rest of the tree is shared with earlier versions.
+ * Copying a map is a single reference, so keeping a copy of the state at every step
+ * costs memory only for the variables that changed in between.
+ */
+class VarMap {
+private:
+	struct Node;
+	typedef std::shared_ptr<const Node> NodePtr;
+	struct Node {
+		std::string key;
+		int value;
+		int height;
+		NodePtr left, right;
+	};
+
+	NodePtr root;
+	size_t count;
+
+	static int height(const NodePtr &node) { return node ? node->height : 0; }
+	static NodePtr make(const std::string &key, int value, const NodePtr &left, const NodePtr &right);
+	static NodePtr balance(const std::string &key, int value, const NodePtr &left, const NodePtr &right);
+	static NodePtr insert(const NodePtr &node, const std::string &key, int value, bool &added);
+
+	template <typename F>
+	static void visit(const Node *node, F &f)
+	{
+		if (!node) return;
+		visit(node->left.get(), f);
+		f(node->key, node->value);
+		visit(node->right.get(), f);
+	}
+public:
+	VarMap() : root(), count(0) {}
+
+	bool has(const std::string &key) const { return find(key) != nullptr; }
+	/** nullptr if there is no such variable */
+	const int *find(const std::string &key) const;
+	/** 0 if there is no such variable */
+	int get(const std::string &key) const;
+	void set(const std::string &key, int value);
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	void clear() { root = nullptr; count = 0; }
+
+	/** Call f(key, value) in order of key. f may set variables, the visit goes over the map as it was */
+	template <typename F>
+	void forEach(F f) const
+	{
+		NodePtr snapshot = root;
+		visit(snapshot.get(), f);
+	}
+};
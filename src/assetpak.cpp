@@ -0,0 +1,290 @@
+#include "assetpak.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char PAK_MAGIC[4] = { 'K', 'P', 'A', 'K' };
+
+// whether the pixels of a record lie within a file of the given size, without overflowing on corrupt values
+static bool fits(const AssetPak::Record &record, uint64_t size)
+{
+	uint64_t pixels = (uint64_t)record.width * record.height; // can't overflow, both are 32 bit
+	if (pixels > UINT64_MAX / 4) return false;
+	uint64_t bytes = pixels * 4;
+	return record.offset <= size && bytes <= size - record.offset;
+}
+
+bool AssetPak::open(const string &path)
+{
+	unmap();
+
+#ifdef USE_MMAP
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			data = (const uint8_t*)p;
+			size = st.st_size;
+		}
+	}
+	close(fd);
+#endif
+
+	if (!data)
+	{
+		ifstream infile(path, ios::binary);
+		if (!infile) return false;
+		fallback.assign(istreambuf_iterator<char>(infile), istreambuf_iterator<char>());
+		data = fallback.data();
+		size = fallback.size();
+	}
+
+	// validate everything once, so lookups can trust the index
+	const Header *header = (const Header*)data;
+	bool valid = size >= sizeof(Header)
+		&& memcmp(header->magic, PAK_MAGIC, 4) == 0
+		&& header->version == VERSION
+		&& size >= sizeof(Header) + (uint64_t)header->count * sizeof(Record);
+	for (size_t i = 0; valid && i < getCount(); ++i)
+	{
+		const Record &record = getRecord(i);
+		valid = record.id[sizeof(record.id) - 1] == '\0'
+			&& fits(record, size);
+	}
+
+	if (!valid)
+	{
+		cout << "Invalid asset archive " << path << endl;
+		unmap();
+		return false;
+	}
+	return true;
+}
+
+void AssetPak::unmap()
+{
+#ifdef USE_MMAP
+	if (data && fallback.empty())
+	{
+		munmap((void*)data, size);
+	}
+#endif
+	fallback.clear();
+	data = nullptr;
+	size = 0;
+}
+
+size_t AssetPak::getCount() const
+{
+	return data ? ((const Header*)data)->count : 0;
+}
+
+const AssetPak::Record &AssetPak::getRecord(size_t i) const
+{
+	return ((const Record*)(data + sizeof(Header)))[i];
+}
+
+const AssetPak::Record *AssetPak::find(const string &id, int maxWidth) const
+{
+	const Record *best = nullptr;
+	for (size_t i = 0; i < getCount(); ++i)
+	{
+		const Record &record = getRecord(i);
+		if (id != record.id) continue;
+
+		int w = record.width;
+		if (!best)
+		{
+			best = &record;
+		}
+		else if (w <= maxWidth)
+		{
+			if ((int)best->width > maxWidth || w > (int)best->width) best = &record;
+		}
+		else if ((int)best->width > maxWidth && w < (int)best->width)
+		{
+			best = &record;
+		}
+	}
+	return best;
+}
+
+ALLEGRO_BITMAP *AssetPak::createBitmap(const Record &record) const
+{
+	ALLEGRO_BITMAP *bmp = al_create_bitmap(record.width, record.height);
+	if (!bmp) return nullptr;
+
+	ALLEGRO_LOCKED_REGION *region = al_lock_bitmap(bmp, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+	if (!region)
+	{
+		al_destroy_bitmap(bmp);
+		return nullptr;
+	}
+
+	const uint8_t *src = data + record.offset;
+	size_t rowBytes = record.width * 4;
+	for (uint32_t y = 0; y < record.height; ++y)
+	{
+		memcpy((uint8_t*)region->data + y * region->pitch, src + y * rowBytes, rowBytes);
+	}
+	al_unlock_bitmap(bmp);
+	return bmp;
+}
+
+static bool writeImage(ofstream &outfile, ALLEGRO_BITMAP *src, int w, int h)
+{
+	ALLEGRO_BITMAP *scaled = al_create_bitmap(w, h);
+	if (!scaled) return false;
+
+	ALLEGRO_STATE state;
+	al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+	al_set_target_bitmap(scaled);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	al_draw_scaled_bitmap(src, 0, 0, al_get_bitmap_width(src), al_get_bitmap_height(src), 0, 0, w, h, 0);
+	al_restore_state(&state);
+
+	ALLEGRO_LOCKED_REGION *region = al_lock_bitmap(scaled, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+	if (region)
+	{
+		for (int y = 0; y < h; ++y)
+		{
+			outfile.write((const char*)region->data + y * region->pitch, w * 4);
+		}
+		al_unlock_bitmap(scaled);
+	}
+	al_destroy_bitmap(scaled);
+	return region != nullptr;
+}
+
+bool AssetPak::pack(const string &dir, const string &path, const vector<int> &widths)
+{
+	assert (!widths.empty());
+	int maxWidth = *max_element(widths.begin(), widths.end());
+
+	// collect images and the sizes they'll be stored at
+	struct Job { string file; Record record; };
+	vector<Job> jobs;
+
+	ALLEGRO_FS_ENTRY *dirEntry = al_create_fs_entry(dir.c_str());
+	if (!dirEntry || !al_open_directory(dirEntry))
+	{
+		cout << "Could not open asset directory " << dir << endl;
+		if (dirEntry) al_destroy_fs_entry(dirEntry);
+		return false;
+	}
+
+	int oldFlags = al_get_new_bitmap_flags();
+	al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP | ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR);
+
+	ALLEGRO_FS_ENTRY *fileEntry;
+	while ((fileEntry = al_read_directory(dirEntry)) != NULL)
+	{
+		ALLEGRO_PATH *filePath = al_create_path(al_get_fs_entry_name(fileEntry));
+		string ext = al_get_path_extension(filePath);
+		transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+		string id = al_get_path_basename(filePath);
+
+		ALLEGRO_BITMAP *bmp = (ext == ".jpg" || ext == ".jpeg" || ext == ".png") ? al_load_bitmap(al_get_fs_entry_name(fileEntry)) : NULL;
+		if (bmp && id.size() < sizeof(Record::id))
+		{
+			int ow = al_get_bitmap_width(bmp);
+			int oh = al_get_bitmap_height(bmp);
+			vector<int> sizes;
+			for (int w : widths)
+			{
+				if (w < ow) sizes.push_back(w);
+			}
+			if (ow <= maxWidth) sizes.push_back(ow);
+
+			for (int w : sizes)
+			{
+				Job job;
+				job.file = al_get_fs_entry_name(fileEntry);
+				memset(&job.record, 0, sizeof(Record));
+				strcpy(job.record.id, id.c_str());
+				job.record.width = w;
+				job.record.height = max(1, oh * w / ow);
+				jobs.push_back(job);
+			}
+		}
+		else if (bmp)
+		{
+			cout << "Skipping " << id << ": name too long" << endl;
+		}
+		if (bmp) al_destroy_bitmap(bmp);
+
+		al_destroy_path(filePath);
+		al_destroy_fs_entry(fileEntry);
+	}
+	al_close_directory(dirEntry);
+	al_destroy_fs_entry(dirEntry);
+
+	// pixel data starts after the index, each image aligned to 16 bytes
+	uint64_t offset = sizeof(Header) + jobs.size() * sizeof(Record);
+	for (auto &job : jobs)
+	{
+		offset = (offset + 15) & ~(uint64_t)15;
+		job.record.offset = offset;
+		offset += (uint64_t)job.record.width * job.record.height * 4;
+	}
+
+	// write to a temporary file, so a failed pack doesn't leave a broken archive behind
+	string tempPath = path + ".tmp";
+	ofstream outfile(tempPath, ios::binary | ios::trunc);
+	Header header;
+	memcpy(header.magic, PAK_MAGIC, 4);
+	header.version = VERSION;
+	header.count = jobs.size();
+	header.reserved = 0;
+	outfile.write((const char*)&header, sizeof(Header));
+	for (auto &job : jobs)
+	{
+		outfile.write((const char*)&job.record, sizeof(Record));
+	}
+
+	bool ok = (bool)outfile;
+	ALLEGRO_BITMAP *src = NULL;
+	string srcFile;
+	for (size_t i = 0; ok && i < jobs.size(); ++i)
+	{
+		Job &job = jobs[i];
+		if (job.file != srcFile)
+		{
+			if (src) al_destroy_bitmap(src);
+			src = al_load_bitmap(job.file.c_str());
+			srcFile = job.file;
+		}
+
+		while ((uint64_t)outfile.tellp() < job.record.offset) outfile.put(0);
+		ok = src && writeImage(outfile, src, job.record.width, job.record.height);
+		cout << "Packed " << job.record.id << " at " << job.record.width << "x" << job.record.height << endl;
+	}
+	if (src) al_destroy_bitmap(src);
+	al_set_new_bitmap_flags(oldFlags);
+
+	outfile.close();
+	ok = ok && (bool)outfile && rename(tempPath.c_str(), path.c_str()) == 0;
+	if (!ok)
+	{
+		cout << "Failed to write asset archive " << path << endl;
+		remove(tempPath.c_str());
+	}
+	return ok;
+}
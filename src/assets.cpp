@@ -0,0 +1,431 @@
+#include "assets.h"
+#include "profiler.h"
+#include "stats.h"
+#include "latency.h"
+
+#include <allegro5/allegro_audio.h>
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <iostream>
+#include <set>
+
+using namespace std;
+
+static const char *IMAGE_EXTENSIONS[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tga" };
+static const char *SAMPLE_EXTENSIONS[] = { ".ogg", ".wav", ".flac", ".opus" };
+
+// sound files larger than this are streamed instead of decoded. About 15 seconds of ogg.
+static const int64_t STREAM_THRESHOLD = 256 << 10;
+
+template<size_t N>
+static bool hasExtension(const char *(&list)[N], const string &ext)
+{
+	return find_if(list, list + N, [&](const char *e) { return ext == e; }) != list + N;
+}
+
+Assets::Assets(const string &dir, JobSystem &jobs) : jobs(jobs), pak(), targetWidth(INT_MAX),
+	usedBytes(), resident(), budget(), useCounter(0)
+{
+	budget[IMAGE] = 64 << 20;
+	budget[SAMPLE] = 16 << 20;
+	index(dir);
+}
+
+Assets::~Assets()
+{
+	// the jobs refer to the entries
+	for (auto &byId : entries)
+	{
+		for (auto &pair : byId)
+		{
+			if (pair.second.job) jobs.cancel(pair.second.job);
+		}
+	}
+	for (auto &byId : entries)
+	{
+		for (auto &pair : byId)
+		{
+			if (pair.second.job) jobs.wait(pair.second.job);
+			unload(pair.second);
+		}
+	}
+}
+
+// list the directory, without loading anything
+void Assets::index(const string &dir)
+{
+	ALLEGRO_FS_ENTRY *dirEntry = al_create_fs_entry(dir.c_str());
+	if (!dirEntry || !al_open_directory(dirEntry))
+	{
+		cout << "Could not open asset directory " << dir << endl;
+		if (dirEntry) al_destroy_fs_entry(dirEntry);
+		return;
+	}
+
+	ALLEGRO_FS_ENTRY *fileEntry;
+	while ((fileEntry = al_read_directory(dirEntry)) != NULL)
+	{
+		ALLEGRO_PATH *path = al_create_path(al_get_fs_entry_name(fileEntry));
+		string ext = al_get_path_extension(path);
+		transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+		Kind kind = KIND_NUM;
+		if (hasExtension(IMAGE_EXTENSIONS, ext)) kind = IMAGE;
+		else if (hasExtension(SAMPLE_EXTENSIONS, ext)) kind = SAMPLE;
+
+		if (kind != KIND_NUM)
+		{
+			add(kind, al_get_path_basename(path), al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP), al_get_fs_entry_size(fileEntry));
+		}
+
+		al_destroy_path(path);
+		al_destroy_fs_entry(fileEntry);
+	}
+
+	al_close_directory(dirEntry);
+	al_destroy_fs_entry(dirEntry);
+
+	// images in the archive take precedence
+	if (pak.open(dir + "/assets.pak"))
+	{
+		for (size_t i = 0; i < pak.getCount(); ++i)
+		{
+			string id = pak.getRecord(i).id;
+			Entry *entry = find(IMAGE, id);
+			if (!entry) entry = &add(IMAGE, id, "", 0);
+			entry->packed = true;
+		}
+	}
+}
+
+Assets::Entry &Assets::add(Kind kind, const string &id, const string &path, int64_t fileSize)
+{
+	Entry &entry = entries[kind][id];
+	entry.kind = kind;
+	entry.id = id;
+	entry.path = path;
+	entry.packed = false;
+	entry.streamed = (kind == SAMPLE && fileSize > STREAM_THRESHOLD);
+	entry.state = Entry::UNLOADED;
+	entry.bmp = NULL;
+	entry.sample = NULL;
+	entry.unloadWhenDone = false;
+	entry.pins = 0;
+	entry.lastUsed = 0;
+	entry.playingUntil = 0;
+	return entry;
+}
+
+// load with the current new bitmap flags, at most targetWidth wide.
+ALLEGRO_BITMAP *Assets::loadImage(const Entry &entry)
+{
+	if (entry.packed)
+	{
+		const AssetPak::Record *record = pak.find(entry.id, targetWidth);
+		return record ? pak.createBitmap(*record) : NULL;
+	}
+
+	ALLEGRO_BITMAP *bmp = al_load_bitmap(entry.path.c_str());
+	if (!bmp || al_get_bitmap_width(bmp) <= targetWidth) return bmp;
+
+	// too wide for the text column
+	int w = al_get_bitmap_width(bmp);
+	int h = al_get_bitmap_height(bmp);
+	int oldFlags = al_get_new_bitmap_flags();
+	al_set_new_bitmap_flags(oldFlags | ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR);
+	ALLEGRO_BITMAP *scaled = al_create_bitmap(targetWidth, max(1, h * targetWidth / w));
+	al_set_new_bitmap_flags(oldFlags);
+	if (scaled)
+	{
+		ALLEGRO_STATE state;
+		al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+		al_set_target_bitmap(scaled);
+		al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+		al_draw_scaled_bitmap(bmp, 0, 0, w, h, 0, 0, al_get_bitmap_width(scaled), al_get_bitmap_height(scaled), 0);
+		al_restore_state(&state);
+		al_destroy_bitmap(bmp);
+		bmp = scaled;
+	}
+	return bmp;
+}
+
+Assets::Entry *Assets::find(Kind kind, const string &id)
+{
+	// the maps don't change after indexing, only the entries do.
+	auto it = entries[kind].find(id);
+	return it == entries[kind].end() ? nullptr : &it->second;
+}
+
+// called without holding the lock. Only the thread that changed the state to DECODING may call this.
+void Assets::decode(Entry &entry, bool video)
+{
+	ALLEGRO_BITMAP *bmp = NULL;
+	ALLEGRO_SAMPLE *sample = NULL;
+	if (entry.kind == IMAGE)
+	{
+		PROFILE_SCOPE("decode");
+		// new bitmap flags are per thread
+		int oldFlags = al_get_new_bitmap_flags();
+		if (!video) al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+		bmp = loadImage(entry);
+		al_set_new_bitmap_flags(oldFlags);
+	}
+	else
+	{
+		sample = al_load_sample(entry.path.c_str());
+	}
+
+	lock_guard<mutex> guard(lockMutex);
+	entry.bmp = bmp;
+	entry.sample = sample;
+	if (!bmp && !sample)
+	{
+		cout << "Could not load " << entry.id << endl;
+		entry.state = Entry::FAILED;
+	}
+	else
+	{
+		// samples don't need an upload step
+		entry.state = (video || entry.kind == SAMPLE) ? Entry::READY : Entry::DECODED;
+		if (entry.state == Entry::READY)
+		{
+			usedBytes[entry.kind] += memorySize(entry);
+			resident[entry.kind]++;
+		}
+	}
+	cond.notify_all();
+}
+
+// called with the lock held. Decode in the background, and upload on the display thread when done.
+void Assets::queue(Entry &entry)
+{
+	Entry *e = &entry;
+	entry.state = Entry::QUEUED;
+	entry.job = jobs.submit([this, e]() {
+		{
+			lock_guard<mutex> guard(lockMutex);
+			if (e->state != Entry::QUEUED) return; // loaded in the meantime
+			e->state = Entry::DECODING;
+		}
+		decode(*e, false);
+	}, JobSystem::LOW, [this, e]() {
+		lock_guard<mutex> guard(lockMutex);
+		e->job = nullptr;
+		if (e->unloadWhenDone)
+		{
+			// not wanted anymore, and not uploaded yet
+			e->unloadWhenDone = false;
+			if (e->pins == 0) unload(*e);
+		}
+		if (e->state == Entry::DECODED)
+		{
+			upload(*e);
+			e->lastUsed = ++useCounter;
+		}
+	});
+}
+
+// called with the lock held, from the display thread.
+void Assets::upload(Entry &entry)
+{
+	assert (entry.state == Entry::DECODED);
+	PROFILE_SCOPE("upload");
+	al_convert_bitmap(entry.bmp);
+	entry.state = Entry::READY;
+	usedBytes[IMAGE] += memorySize(entry);
+	resident[IMAGE]++;
+}
+
+// called with the lock held
+void Assets::unload(Entry &entry)
+{
+	if (entry.state == Entry::DECODING)
+	{
+		// let it finish, the job's completion unloads it
+		entry.unloadWhenDone = true;
+		return;
+	}
+
+	if (entry.state == Entry::READY)
+	{
+		usedBytes[entry.kind] -= memorySize(entry);
+		resident[entry.kind]--;
+	}
+	if (entry.bmp) al_destroy_bitmap(entry.bmp);
+	if (entry.sample) al_destroy_sample(entry.sample);
+	entry.bmp = NULL;
+	entry.sample = NULL;
+	if (entry.state != Entry::FAILED) entry.state = Entry::UNLOADED;
+}
+
+Assets::Entry *Assets::get(Kind kind, const string &id, unique_lock<mutex> &lock)
+{
+	Entry *entry = find(kind, id);
+	if (!entry) return nullptr;
+	LatencyScope scope(Latency::ASSETS);
+	entry->unloadWhenDone = false; // needed after all
+
+	while (true)
+	{
+		switch (entry->state)
+		{
+		case Entry::READY:
+			entry->lastUsed = ++useCounter;
+			return entry;
+		case Entry::FAILED:
+			return nullptr;
+		case Entry::DECODED:
+			upload(*entry);
+			entry->lastUsed = ++useCounter;
+			return entry;
+		case Entry::DECODING:
+			// the worker is on it already
+			cond.wait(lock);
+			break;
+		case Entry::UNLOADED:
+		case Entry::QUEUED:
+			// needed right now, so load it here
+			if (entry->job) jobs.cancel(entry->job);
+			entry->job = nullptr;
+			entry->state = Entry::DECODING;
+			lock.unlock();
+			decode(*entry, true);
+			lock.lock();
+			break;
+		}
+	}
+}
+
+ALLEGRO_BITMAP *Assets::getBitmap(const string &id)
+{
+	unique_lock<mutex> lock(lockMutex);
+	Entry *entry = get(IMAGE, id, lock);
+	return entry ? entry->bmp : NULL;
+}
+
+ALLEGRO_SAMPLE *Assets::getSample(const string &id)
+{
+	unique_lock<mutex> lock(lockMutex);
+	Entry *entry = get(SAMPLE, id, lock);
+	if (!entry) return NULL;
+
+	// assume it's played right away. Destroying a sample would cut it off.
+	double duration = (double)al_get_sample_length(entry->sample) / al_get_sample_frequency(entry->sample);
+	entry->playingUntil = max(entry->playingUntil, al_get_time() + duration);
+	return entry->sample;
+}
+
+bool Assets::isStreamed(const string &id)
+{
+	Entry *entry = find(SAMPLE, id);
+	return entry && entry->streamed;
+}
+
+string Assets::getPath(Kind kind, const string &id)
+{
+	Entry *entry = find(kind, id);
+	return entry ? entry->path : string();
+}
+
+void Assets::pin(Kind kind, const string &id)
+{
+	lock_guard<mutex> guard(lockMutex);
+	Entry *entry = find(kind, id);
+	if (entry) entry->pins++;
+}
+
+void Assets::unpin(Kind kind, const string &id)
+{
+	lock_guard<mutex> guard(lockMutex);
+	Entry *entry = find(kind, id);
+	if (!entry) return;
+	assert (entry->pins > 0);
+	entry->pins--;
+}
+
+void Assets::prefetch(const vector<string> &images, const vector<string> &samples)
+{
+	const vector<string> *ids[KIND_NUM] = { &images, &samples };
+
+	lock_guard<mutex> guard(lockMutex);
+	for (int kind = 0; kind < KIND_NUM; ++kind)
+	{
+		set<string> wanted(ids[kind]->begin(), ids[kind]->end());
+		for (auto &pair : entries[kind])
+		{
+			Entry &entry = pair.second;
+			if (wanted.count(pair.first) && !entry.streamed)
+			{
+				entry.unloadWhenDone = false;
+				if (entry.state == Entry::UNLOADED)
+				{
+					queue(entry);
+				}
+			}
+			else if (entry.pins == 0)
+			{
+				// out of reach: forget it, or don't start on it
+				if (entry.state == Entry::QUEUED)
+				{
+					jobs.cancel(entry.job);
+					entry.job = nullptr;
+					entry.state = Entry::UNLOADED;
+				}
+				else unload(entry);
+			}
+		}
+	}
+}
+
+void Assets::update()
+{
+	lock_guard<mutex> guard(lockMutex);
+	evict(IMAGE);
+	evict(SAMPLE);
+
+	Stats::set(Stats::BITMAPS, resident[IMAGE]);
+	Stats::set(Stats::BITMAP_BYTES, usedBytes[IMAGE]);
+}
+
+size_t Assets::memorySize(const Entry &entry)
+{
+	if (entry.bmp)
+	{
+		return (size_t)al_get_bitmap_width(entry.bmp) * al_get_bitmap_height(entry.bmp) * 4;
+	}
+	if (entry.sample)
+	{
+		return (size_t)al_get_sample_length(entry.sample)
+			* al_get_channel_count(al_get_sample_channels(entry.sample))
+			* al_get_audio_depth_size(al_get_sample_depth(entry.sample));
+	}
+	return 0;
+}
+
+// called with the lock held
+void Assets::evict(Kind kind)
+{
+	if (usedBytes[kind] <= budget[kind]) return;
+
+	double now = al_get_time();
+	vector<Entry*> candidates;
+	for (auto &pair : entries[kind])
+	{
+		Entry &entry = pair.second;
+		if (entry.state == Entry::READY && entry.pins == 0 && entry.playingUntil < now)
+		{
+			candidates.push_back(&entry);
+		}
+	}
+	sort(candidates.begin(), candidates.end(), [](const Entry *a, const Entry *b) {
+		return a->lastUsed < b->lastUsed;
+	});
+
+	// pinned assets can't go, so the budget may still be exceeded afterwards
+	for (Entry *entry : candidates)
+	{
+		if (usedBytes[kind] <= budget[kind]) break;
+		unload(*entry);
+	}
+}
@@ -0,0 +1,34 @@
+#include "clip.h"
+
+#include <allegro5/allegro.h>
+#include <cmath>
+
+using namespace std;
+
+void getClippingRectangle(int *x, int *y, int *w, int *h)
+{
+	int px, py, pw, ph;
+	al_get_clipping_rectangle(&px, &py, &pw, &ph);
+	const ALLEGRO_TRANSFORM *t = al_get_current_transform();
+	float sx = t->m[0][0], sy = t->m[1][1];
+	float tx = t->m[3][0], ty = t->m[3][1];
+
+	// round outwards, so nothing that would be visible is left out
+	int left = (int)floorf((px - tx) / sx);
+	int top = (int)floorf((py - ty) / sy);
+	*x = left;
+	*y = top;
+	*w = (int)ceilf((px + pw - tx) / sx) - left;
+	*h = (int)ceilf((py + ph - ty) / sy) - top;
+}
+
+void setClippingRectangle(int x, int y, int w, int h)
+{
+	const ALLEGRO_TRANSFORM *t = al_get_current_transform();
+	float sx = t->m[0][0], sy = t->m[1][1];
+	float tx = t->m[3][0], ty = t->m[3][1];
+
+	int left = (int)lroundf(x * sx + tx);
+	int top = (int)lroundf(y * sy + ty);
+	al_set_clipping_rectangle(left, top, (int)lroundf((x + w) * sx + tx) - left, (int)lroundf((y + h) * sy + ty) - top);
+}
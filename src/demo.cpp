@@ -15,7 +15,6 @@
 #include "multiline.h"
 #include "rect.h"
 #include "openLink.h"
-#include "text.h"
 #include "richtext.h"
 
 using namespace std;
@@ -47,7 +46,7 @@ class DemoImpl: public Demo {
 	
 	ALLEGRO_FONT *normal, *bold, *italic, *header;
 	ALLEGRO_COLOR background, text, white;
-	list<ComponentPtr> components;
+	SegmentStore segments;
 	StyleData style;
 	float xflow, yflow;
 
@@ -70,11 +69,10 @@ class DemoImpl: public Demo {
 
 		float x = 0;
 		float y = 0;
-		appendRichText(TEST_TEXT, &x, &y, 400, components, style);
+		appendRichText(TEST_TEXT, &x, &y, 400, segments, style);
 	}
 
 	virtual void draw() {
-		ALLEGRO_BITMAP *screen;
 		void *data;
 		int size, i, format;
 		
@@ -82,15 +80,8 @@ class DemoImpl: public Demo {
 
 		al_clear_to_color(background);
 
-		screen = al_get_target_bitmap();
-
-		GraphicsContext gc;
-		gc.buffer = screen;
-		gc.xofst = 0;
-		gc.yofst = 0;
-
-		for(auto &comp : components) {
-			comp->draw(gc);
+		for(auto &seg : segments) {
+			segments.draw(seg, 0, 0);
 		}
 	}
 
@@ -99,18 +90,12 @@ class DemoImpl: public Demo {
 	}
 
 	virtual void openLinkAt(int x, int y) override {
-		// for(auto &span : spans) {
-		// 	if (span.type == TextSpan::TYPE_LINK) {
-		// 		for (auto &rect : span.linkHotspots) {
-		// 			if (rect.contains(Point(x, y))) {
-		// 				printf("Opening link: %s\n", span.href.c_str());
-		// 				// open in browser
-		// 				openLink(span.href.c_str());
-		// 				return;
-		// 			}
-		// 		}
-		// 	}
-		// }
+		for(auto &seg : segments) {
+			if (seg.type == Segment::LINK && seg.contains(x, y)) {
+				segments.click(seg);
+				return;
+			}
+		}
 	}
 
 };
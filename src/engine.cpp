@@ -4,35 +4,91 @@
 #include "DrawStrategy.h"
 #include "parser.h"
 #include "resources.h"
+#include "assets.h"
+#include "stats.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
 
 std::shared_ptr<Resources> Engine::resources = nullptr;
+std::shared_ptr<Assets> Engine::assets = nullptr;
 ALLEGRO_FONT *Engine::font = NULL;
 bool Engine::debugMode = false;
+bool Engine::statsMode = false;
 
 using namespace std;
 
-void Engine::init() {
+bool Engine::init(int &exitCode) {
+	auto &opts = Simple::MainLoop::getMainLoop()->getOpts();
+	if (find(opts.begin(), opts.end(), "-packassets") != opts.end())
+	{
+		// pre-scale images to fit the text column at common window sizes
+		bool ok = AssetPak::pack("data", "data/assets.pak", { 320, 480, 640, 960 });
+		exitCode = ok ? 0 : 1;
+		return false;
+	}
+
 	resources = Resources::newInstance();
 
-	resources->addDir("data");
+	// only fonts are loaded up front, images and samples when the story gets near them.
+	resources->addFiles("data/*.ttf");
+	assets = make_shared<Assets>("data", Simple::MainLoop::getMainLoop()->getJobs());
 
-	font = resources->getFont("DejaVuSans")->get(16);
+	font = resources->getFont("DejaVuSans")->get(16 * Simple::MainLoop::getMainLoop()->getScale());
 	if (!font) {
 		allegro_message("Error loading \"data/fixed_font.tga\".\n");
-		exit(1);
+		exitCode = 1;
+		return false;
 	}
+	Simple::MainLoop::getMainLoop()->traceStartup("fonts");
 
+	// a scripted run should neither continue from, nor overwrite, the player's progress
+	bool scripted = Simple::MainLoop::getMainLoop()->isScripted() || find(opts.begin(), opts.end(), "-answers") != opts.end();
 	game = Game::newInstance();
+	game->setAutosave(!scripted);
 	game->init(resources);
+	Simple::MainLoop::getMainLoop()->traceStartup("game init");
 
 	ALLEGRO_PATH *localAppData = al_get_standard_path(ALLEGRO_USER_SETTINGS_PATH);
 	string cacheDir = al_path_cstr(localAppData, ALLEGRO_NATIVE_PATH_SEP);
 
-	game->initGame();
+	// continuing from the autosave journal is asked for, with -continue or in the config, and -newgame overrides that
+	bool resume = find(opts.begin(), opts.end(), "-continue") != opts.end()
+		|| get_config_int(Simple::MainLoop::getMainLoop()->getConfig(), "game", "resume", 0) != 0;
+	if (resume && !scripted && find(opts.begin(), opts.end(), "-newgame") == opts.end())
+	{
+		game->continueGame();
+	}
+	else
+	{
+		game->initGame();
+	}
+	Simple::MainLoop::getMainLoop()->traceStartup("first node");
+
+	// play through the story with answers from a file, one number per line
+	auto it = find(opts.begin(), opts.end(), "-answers");
+	if (it != opts.end() && it + 1 != opts.end())
+	{
+		ifstream in(*(it + 1));
+		if (!in)
+		{
+			cout << "Could not open " << *(it + 1) << endl;
+		}
+		vector<int> answers;
+		int answer;
+		while (in >> answer)
+		{
+			answers.push_back(answer);
+		}
+		game->setScriptedAnswers(answers);
+	}
+	return true;
 }
 
 Engine::~Engine() {
 	// clear resources /before/ allegro is uninstalled to prevent sigsegv.
+	game = nullptr;
+	assets = nullptr;
 	resources = nullptr;
 }
 
@@ -45,19 +101,43 @@ void Engine::handleEvent(ALLEGRO_EVENT &event) {
 		debugMode = !debugMode;
 		return; // consume event
 	}
+	if (event.type == ALLEGRO_EVENT_KEY_CHAR &&
+		event.keyboard.keycode == ALLEGRO_KEY_F12)
+	{
+		statsMode = !statsMode;
+		return; // consume event
+	}
 #endif
 	game->handleEvent(event);
 }
 
-bool Engine::update() {
-	bool result = true;
+// counters of the previous frame, top right
+void Engine::drawStats() {
+	int xx = MAIN_WIDTH;
+	int yy = 0;
+	int lineh = al_get_font_line_height(font);
+	for (int i = 0; i < Stats::COUNTER_NUM; ++i)
+	{
+		Stats::Counter counter = (Stats::Counter)i;
+		draw_textf_with_background(font, WHITE, BLACK, xx, yy, ALLEGRO_ALIGN_RIGHT,
+			" %s: %lld", Stats::getName(counter), (long long)Stats::get(counter));
+		yy += lineh;
+	}
+}
+
+Simple::UpdateResult Engine::update() {
+	Simple::UpdateResult result = Simple::UPDATE_REDRAW;
+	assets->update();
 	game->update();
+	if (game->isIdle()) {
+		result = Simple::UPDATE_IDLE;
+	}
 	while(game->hasMsg()) {
 		int msg = game->popMsg();
 		printf("On Handle Message called %i", msg);
 
 		if (msg == Engine::E_QUIT) {
-			result = false;
+			result = Simple::UPDATE_QUIT;
 		}
 	}
 	return result;
@@ -14,15 +14,26 @@
 
 #include "engine.h"
 #include "strutil.h"
-#include "particle.h"
+#include "particlefield.h"
 #include "strutil.h"
 #include <locale>
 #include <stack>
+#include <set>
+#include <deque>
 
 #include "text2.h"
 #include "parser.h"
 #include "textstyle.h"
 #include "resources.h"
+#include "util.h"
+#include "glyphwarm.h"
+#include "assets.h"
+#include "stats.h"
+#include "latency.h"
+#include "governor.h"
+#include "savegame.h"
+#include "journal.h"
+#include "simpleloop.h"
 
 using namespace std;
 
@@ -30,59 +41,82 @@ static const char * STORY_FILE = "data/STORY.txt";
 
 class Squeak
 {
-public:
-	vector<ALLEGRO_SAMPLE_ID> started; // keep track of looped samples
+	// looped sounds are always streamed, so they don't need to stay decoded in memory
+	vector<ALLEGRO_AUDIO_STREAM*> loops;
+	vector<ALLEGRO_AUDIO_STREAM*> streams; // long play-once sounds
 
-	void clear()
+	ALLEGRO_AUDIO_STREAM *startStream(const string &id, ALLEGRO_PLAYMODE mode, float pan)
 	{
-		// stop any looped samples, leaving play-once samples untouched.
-		for (vector<ALLEGRO_SAMPLE_ID>::iterator i = started.begin(); i != started.end(); ++i)
+		if (!al_is_audio_installed()) return NULL;
+
+		// decoding happens in the stream's own thread
+		LatencyScope scope(Latency::ASSETS);
+		ALLEGRO_AUDIO_STREAM *stream = al_load_audio_stream(Engine::getAssets()->getPath(Assets::SAMPLE, id).c_str(), 4, 2048);
+		if (!stream)
 		{
-			al_stop_sample(&(*i));
+			cout << "Could not start stream";
+			return NULL;
 		}
-		started.clear();
+		al_set_audio_stream_playmode(stream, mode);
+		al_set_audio_stream_pan(stream, pan);
+		al_attach_audio_stream_to_mixer(stream, al_get_default_mixer());
+		return stream;
 	}
 
-	void playSample(ALLEGRO_SAMPLE *sample_data)
+public:
+	void clear()
 	{
-		bool success = al_play_sample (sample_data, 1.0, 1.0, 1.0, ALLEGRO_PLAYMODE_ONCE, NULL);
-		if (!success) {
-			cout << "Could not play sample";
+		// stop any looped samples, leaving play-once samples untouched.
+		for (auto stream : loops)
+		{
+			al_destroy_audio_stream(stream);
 		}
+		loops.clear();
 	}
 
-	void init()
+	void playSample(const string &id)
 	{
-		bool success = al_reserve_samples(16);
-		if (!success)
+		if (Engine::getAssets()->isStreamed(id))
 		{
-			cout << "Could not reserve samples";
+			ALLEGRO_AUDIO_STREAM *stream = startStream(id, ALLEGRO_PLAYMODE_ONCE, 1.0);
+			if (stream) streams.push_back(stream);
 			return;
 		}
+
+		ALLEGRO_SAMPLE *sample_data = Engine::getAssets()->getSample(id);
+		bool success = sample_data && al_play_sample (sample_data, 1.0, 1.0, 1.0, ALLEGRO_PLAYMODE_ONCE, NULL);
+		if (!success) {
+			cout << "Could not play sample";
+		}
 	}
 
 	void startLoop(const string &id)
 	{
 		clear();
 
-		ALLEGRO_SAMPLE_ID sampleid;
-		ALLEGRO_SAMPLE *sample_data = Engine::getResources()->getSampleIfExists(id);
+		ALLEGRO_AUDIO_STREAM *stream = startStream(id, ALLEGRO_PLAYMODE_LOOP, 0.5);
+		if (stream) loops.push_back(stream);
+	}
 
-		if (!sample_data)
-		{
-			cout << "Could not find sample";
-			return;
-		}
+	void update()
+	{
+		// clean up streams that have finished
+		auto done = remove_if(streams.begin(), streams.end(), [](ALLEGRO_AUDIO_STREAM *stream) {
+			if (al_get_audio_stream_playing(stream)) return false;
+			al_destroy_audio_stream(stream);
+			return true;
+		});
+		streams.erase(done, streams.end());
+	}
 
-		bool success = al_play_sample (sample_data, 1.0, 0.5, 1.0, ALLEGRO_PLAYMODE_LOOP, &sampleid);
-		if (!success) {
-			 cout << "Could not start sample";
+	~Squeak()
+	{
+		clear();
+		for (auto stream : streams)
+		{
+			al_destroy_audio_stream(stream);
 		}
-
-		started.push_back(sampleid);
-
 	}
-
 };
 
 class AnswerComponent : public Component {
@@ -97,7 +131,7 @@ enum GameState { ANSWERING, PAUSE };
 class GameImpl : public Game, StatementHandler {
 private:
 	TextCanvas text; // currently displayed text component;
-	Particles particles;
+	ParticleField particles;
 	Squeak squeak;
 	string activeEffect;
 	GameState state;
@@ -106,6 +140,7 @@ private:
 	vector<AnswerComponent> currentAnswers;
 	SimpleState sstate;
 	unique_ptr<Interpreter> interpreter;
+	vector<ALLEGRO_FONT*> fonts; // all fonts that story text can be drawn with
 	Node *getCurrentNode() { return &(story.nodes[sstate.currentNodeName]); }
 	void parse(string fname);
 
@@ -113,6 +148,36 @@ private:
 
 	void executeStatements(vector<Answer> &answerResult, vector<Command>::iterator &i, vector<Command>::iterator end);
 	void executeCommands(vector<Command> commands);
+	void showAnswers(const vector<Answer> &answers);
+	void prefetchAround(const string &nodeName, int hops);
+	int prefetchHops;
+	deque<int> scriptedAnswers;
+	void chooseAnswer(int index);
+
+	// autosave: every choice goes into the journal
+	unique_ptr<Journal> journal;
+	bool autosave;
+	size_t compactEvery; // records
+	JobSystem::Handle journalJob; // writing it, after a start or a compaction
+	uint32_t storyHash;
+	string lastSnapshot; // of where the player is choosing now
+	bool replaying; // through the journal: no text, images or sound
+	string snapshot();
+	void startJournal();
+	void writeJournal(JobSystem &jobs, function<bool(Journal *)> prepare);
+	void compactJournal(const string &before);
+	bool resumeJournal();
+
+	// undo: the state at each choice the player was given, newest last
+	struct Step {
+		SimpleState state; // shares its variables with the steps around it
+		size_t position; // in the transcript
+		shared_ptr<const vector<Answer>> answers;
+		string effect;
+	};
+	deque<Step> history;
+	size_t historyDepth; // steps, 0 to turn undo off
+	void rewind(size_t steps);
 
 	virtual void gameAssert(bool test, const string &data) override;
 	virtual void executeSideEffect(Command *i) override;
@@ -122,7 +187,7 @@ private:
 	void loadGame()
 	{
 		SimpleState newstate;
-		bool ok = newstate.load();
+		bool ok = SaveGame::load(storyHash, newstate);
 		text.append ("Game loaded", MAGENTA);
 		if (!ok) {
 			text.append ("Something went wrong while loading!", RED);
@@ -132,24 +197,49 @@ private:
 		{
 			sstate = newstate;
 			executeCommands (getCurrentNode()->commands);
+			startJournal();
 		}
 	}
 
+	// written in the background. Only the latest save is kept, so one that didn't start yet can be dropped.
+	JobSystem::Handle saveJob;
+
 	virtual void saveGame() override
 	{
-		sstate.save();
-		text.append ("Game saved", MAGENTA);
+		JobSystem &jobs = Simple::MainLoop::getMainLoop()->getJobs();
+		if (saveJob) jobs.cancel(saveJob);
+		string data = snapshot();
+		uint64_t generation = SaveGame::newGeneration();
+		auto ok = make_shared<bool>(false);
+		saveJob = jobs.submit([data, generation, ok]() {
+			*ok = SaveGame::write(data, generation);
+		}, JobSystem::HIGH, [this, ok]() {
+			saveJob = nullptr;
+			if (*ok) text.append ("Game saved", MAGENTA);
+			else text.append ("Something went wrong while saving!", RED);
+		});
 	}
 
 	/**
 	 * Bring the game in a clean starting state, but don't
 	 * execute any node yet.
 	 */
+	// from the state set up by clearState()
+	void startGame()
+	{
+		// decode the first images in parallel, instead of one by one when they're appended.
+		prefetchAround(sstate.currentNodeName, prefetchHops);
+		executeCommands (getCurrentNode()->commands);
+		state = PAUSE;
+		startJournal();
+	}
+
 	void clearState()
 	{
 		text.clear();
-		particles.setEffect(CLEAR);
+		particles.setEffect(ParticleField::CLEAR);
 		squeak.clear();
+		history.clear();
 
 		parse(STORY_FILE);
 	//	parse("example.txt");
@@ -158,7 +248,7 @@ private:
 		sstate.gameVariables.clear();
 		for (vector<string>::iterator i = story.flags.begin(); i != story.flags.end(); ++i)
 		{
-			sstate.gameVariables[*i] = 0;
+			sstate.gameVariables.set(*i, 0);
 		}
 	}
 
@@ -194,8 +284,13 @@ public:
 	virtual void initGame() override
 	{
 		clearState();
-		executeCommands (getCurrentNode()->commands);
-		state = PAUSE;
+		startGame();
+	}
+
+	virtual void continueGame() override
+	{
+		clearState();
+		if (!resumeJournal()) startGame();
 	}
 
 	virtual void reloadGameIfExists() override
@@ -203,21 +298,45 @@ public:
 		clearState();
 
 		SimpleState newstate;
-		bool ok = newstate.load();
+		bool ok = SaveGame::load(storyHash, newstate);
 
 		if (ok)
 		{
 			sstate = newstate;
 		}
 
+		prefetchAround(sstate.currentNodeName, prefetchHops);
 		executeCommands (getCurrentNode()->commands);
+		startJournal();
 	}
 
+	virtual void setAutosave(bool value) override { autosave = value; }
+
 	virtual void update() override;
+	virtual bool isIdle() override;
+	virtual void setScriptedAnswers(const vector<int> &answers) override
+	{
+		scriptedAnswers.assign(answers.begin(), answers.end());
+	}
 	virtual void draw(const GraphicsContext &gc) override;
 	virtual void handleEvent(ALLEGRO_EVENT &event) override;
 	virtual void init(std::shared_ptr<Resources> res) override;
-	virtual ~GameImpl() {}
+	virtual ~GameImpl()
+	{
+		JobSystem &jobs = Simple::MainLoop::getMainLoop()->getJobs();
+		// don't lose a save that is still being written
+		if (saveJob)
+		{
+			jobs.wait(saveJob);
+			jobs.cancel(saveJob); // the completion refers to this
+		}
+		// the journal would be left behind the game
+		if (journalJob)
+		{
+			jobs.wait(journalJob);
+			jobs.cancel(journalJob);
+		}
+	}
 	GameImpl();
 
 	virtual void debugMsg(const string & msg, ALLEGRO_COLOR color) override
@@ -241,16 +360,26 @@ void GameImpl::gameAssert(bool test, const string &value)
 	if (!test) text.append("ERROR: " + value + "\n", RED);
 }
 
-GameImpl::GameImpl() : activeEffect("clear"), state(PAUSE), sstate()
+GameImpl::GameImpl() : activeEffect("clear"), state(PAUSE), sstate(), prefetchHops(2),
+	autosave(true), compactEvery(64), storyHash(0), replaying(false), historyDepth(256)
 {
 	// layout
-	text.setLocation(80, 80, MAIN_WIDTH-160, 320);
+	int s = Simple::MainLoop::getMainLoop()->getScale();
+	text.setLocation(80 * s, 80 * s, MAIN_WIDTH - 160 * s, 320 * s);
 	particles.setLocation(0, 0, MAIN_WIDTH, MAIN_HEIGHT);
+	particles.setPixelScale(s);
 }
 
 void GameImpl::update()
 {
+	// effects are scaled back when frames take too long
+	const Governor::Level &quality = Governor::getSettings();
+	particles.setDensity(quality.particleDensity);
+	particles.setEffectScale(quality.effectScale);
+	text.setTileBudget(quality.tileBudget);
+
 	particles.update();
+	squeak.update();
 
 	text.speedUp = Engine::isDebug();
 	text.update();
@@ -267,6 +396,156 @@ void GameImpl::update()
 			break;
 		}
 	}
+
+	if (state == ANSWERING && !scriptedAnswers.empty() && !currentAnswers.empty())
+	{
+		int index = scriptedAnswers.front() - 1;
+		scriptedAnswers.pop_front();
+		chooseAnswer(index);
+	}
+}
+
+void GameImpl::chooseAnswer(int index)
+{
+	if (index < 0 || index >= (int)currentAnswers.size())
+	{
+		stringstream ss;
+		ss << "Answer " << (index + 1) << " out of range, there are " << currentAnswers.size() << " answers";
+		gameAssert(false, ss.str());
+		return;
+	}
+	if (replaying)
+	{
+		executeCommands (currentAnswers[index].answer.commands);
+		return;
+	}
+
+	Latency::choice();
+	LatencyScope scope(Latency::INTERPRET);
+	string before = lastSnapshot;
+	if (journal) journal->append(Journal::Choice { index, currentAnswers[index].answer.lineno });
+	executeCommands (currentAnswers[index].answer.commands);
+	if (journal)
+	{
+		lastSnapshot = snapshot();
+		compactJournal(before);
+	}
+}
+
+string GameImpl::snapshot()
+{
+	vector<int> lines;
+	for (const AnswerComponent &comp : currentAnswers)
+	{
+		lines.push_back(comp.answer.lineno);
+	}
+	return SaveGame::encode(sstate, lines, storyHash);
+}
+
+// from the current position, with no choices yet
+void GameImpl::startJournal()
+{
+	if (!journal) return;
+	lastSnapshot = snapshot();
+	journal->start(lastSnapshot);
+	// a write or compaction of the old journal isn't needed. One a worker is on already finds that it started over.
+	JobSystem &jobs = Simple::MainLoop::getMainLoop()->getJobs();
+	if (journalJob) jobs.cancel(journalJob);
+	writeJournal(jobs, nullptr);
+}
+
+// in the background, after running prepare (which returns false if there is nothing to write)
+void GameImpl::writeJournal(JobSystem &jobs, function<bool(Journal *)> prepare)
+{
+	Journal *j = journal.get();
+	auto ok = make_shared<bool>(true);
+	journalJob = jobs.submit([j, prepare, ok]() {
+		if (!prepare || prepare(j)) *ok = j->write();
+	}, JobSystem::LOW, [this, ok]() {
+		journalJob = nullptr;
+		// choices are still kept in memory, the next compaction tries again
+		if (!*ok) text.append ("Something went wrong while autosaving!", RED);
+	});
+}
+
+// before: the snapshot from before the last choice. That choice is kept, so a resume has something to show.
+void GameImpl::compactJournal(const string &before)
+{
+	if (journal->getRecordCount() < compactEvery || journalJob) return;
+	size_t first = journal->getChoiceCount() - 1;
+	uint64_t epoch = journal->getEpoch();
+	writeJournal(Simple::MainLoop::getMainLoop()->getJobs(), [before, first, epoch](Journal *j) {
+		return j->compact(before, first, epoch);
+	});
+}
+
+/**
+ * Continue where the journal left off: from its snapshot, go through the choices in it
+ * without output, except for the last one, so the screen shows what followed that.
+ */
+bool GameImpl::resumeJournal()
+{
+	string data;
+	vector<Journal::Choice> choices;
+	SimpleState saved;
+	vector<int> lines;
+	if (!journal || !journal->read(data, choices)) return false;
+	if (!SaveGame::decode(data, storyHash, saved, lines)) return false;
+
+	if (choices.empty())
+	{
+		// nothing chosen since the snapshot, start the node over, like loading a save
+		sstate = saved;
+		startGame();
+		return true;
+	}
+	// on a copy, so that the state is untouched if this fails
+	SimpleState resumed = saved;
+	vector<Answer> answers;
+	for (int line : lines)
+	{
+		Answer answer;
+		if (!interpreter->findAnswer(resumed, line, answer)) return false;
+		answers.push_back(answer);
+	}
+	sstate = resumed;
+	showAnswers(answers);
+
+	replaying = true;
+	size_t done = 0;
+	for (const Journal::Choice &choice : choices)
+	{
+		// the story must offer the same answer, or the rest won't make sense
+		if (choice.index < 0 || choice.index >= (int)currentAnswers.size()
+			|| currentAnswers[choice.index].answer.lineno != choice.lineno) break;
+
+		if (done + 1 == choices.size())
+		{
+			// the last one is shown, and starts the new journal
+			replaying = false;
+			startJournal();
+			prefetchAround(sstate.currentNodeName, prefetchHops);
+		}
+		chooseAnswer(choice.index);
+		done++;
+	}
+	replaying = false;
+
+	if (done < choices.size())
+	{
+		stringstream ss;
+		ss << "Could only replay " << done << " of " << choices.size() << " choices";
+		text.append(ss.str(), RED);
+		startJournal();
+	}
+	cout << "Resumed after " << done << " choices" << endl;
+	return true;
+}
+
+bool GameImpl::isIdle()
+{
+	// after CLEAR, the remaining particles still have to leave the screen
+	return state == ANSWERING && !text.isBusy() && particles.isIdle() && scriptedAnswers.empty();
 }
 
 void GameImpl::handleEvent(ALLEGRO_EVENT &event)
@@ -294,12 +573,26 @@ void GameImpl::handleEvent(ALLEGRO_EVENT &event)
 				saveGame();
 			}
 			break;
+		case ALLEGRO_KEY_PGUP:
+			text.scrollBy(-text.geth());
+			break;
+		case ALLEGRO_KEY_PGDN:
+			text.scrollBy(text.geth());
+			break;
+		case ALLEGRO_KEY_END:
+			text.scrollToEnd();
+			break;
 		// case ALLEGRO_KEY_ESCAPE:
 		// 	pushMsg (Engine::E_PAUSE);
 		// 	break;
 		}
 	}
 
+	if (event.type == ALLEGRO_EVENT_MOUSE_AXES && event.mouse.dz != 0) {
+		// scroll back through the transcript
+		text.scrollBy(-event.mouse.dz * 40 * Simple::MainLoop::getMainLoop()->getScale());
+	}
+
 	if (event.type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN || event.type == ALLEGRO_EVENT_TOUCH_BEGIN) {
 		int mx = 0, my = 0;
 		if (event.type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN) {
@@ -316,11 +609,8 @@ void GameImpl::handleEvent(ALLEGRO_EVENT &event)
 			// TODO
 		}
 
-		auto comp = text.getComponentAt(mx, my);
-		if (comp) {
-			// trigger optional click handler on child text components
-			comp->handleEvent(event);
-		}
+		// trigger click handler of links in the text
+		text.clickAt(mx, my);
 	}
 
 	if (state != ANSWERING) return; // ignore key events
@@ -343,6 +633,9 @@ void GameImpl::handleEvent(ALLEGRO_EVENT &event)
 			}
 			selectedAnswer->selected = true;
 			break;
+		case ALLEGRO_KEY_BACKSPACE:
+			rewind(1);
+			break;
 		case ALLEGRO_KEY_DOWN:
 			selectedAnswer->selected = false;
 			selectedAnswer++;
@@ -354,7 +647,7 @@ void GameImpl::handleEvent(ALLEGRO_EVENT &event)
 			break;
 		case ALLEGRO_KEY_ENTER:
 			// execute associated commands
-			executeCommands (selectedAnswer->answer.commands);
+			chooseAnswer(selectedAnswer - currentAnswers.begin());
 			break;
 		}
 	}
@@ -362,6 +655,9 @@ void GameImpl::handleEvent(ALLEGRO_EVENT &event)
 
 void GameImpl::executeSideEffect(Command *i)
 {
+	// replaying the journal only has to get the state right, the effect is still needed for the screen
+	if (replaying && i->commandType != EFFECT) return;
+
 	switch (i->commandType)
 	{
 	case END:
@@ -380,10 +676,9 @@ void GameImpl::executeSideEffect(Command *i)
 		}
 		break;
 	case IMAGE: {
-		ALLEGRO_BITMAP *img = Engine::getResources()->getBitmapIfExists(i->parameter);
-		if (img)
+		if (Engine::getAssets()->exists(Assets::IMAGE, i->parameter))
 		{
-			text.appendImage(img);
+			text.appendImage(i->parameter);
 		}
 		else
 		{
@@ -394,10 +689,9 @@ void GameImpl::executeSideEffect(Command *i)
 		break;
 	}
 	case SAMPLE: {
-		ALLEGRO_SAMPLE *sam = Engine::getResources()->getSampleIfExists(i->parameter);
-		if (sam)
+		if (Engine::getAssets()->exists(Assets::SAMPLE, i->parameter))
 		{
-			squeak.playSample(sam);
+			squeak.playSample(i->parameter);
 		}
 		else
 		{
@@ -413,47 +707,47 @@ void GameImpl::executeSideEffect(Command *i)
 		activeEffect = i->parameter;
 		if (i->parameter == "SNOW")
 		{
-			particles.setEffect(SNOW);
+			particles.setEffect(ParticleField::SNOW);
 			squeak.clear();
 		}
 		else if (i->parameter == "STARS")
 		{
-			particles.setEffect(STARS);
+			particles.setEffect(ParticleField::STARS);
 			squeak.clear();
 		}
 		else if (i->parameter == "METEOR")
 		{
-			particles.setEffect(METEOR);
+			particles.setEffect(ParticleField::METEOR);
 			squeak.clear();
 		}
 		else if (i->parameter == "ANTIGRAV")
 		{
-			particles.setEffect(ANTIGRAV);
+			particles.setEffect(ParticleField::ANTIGRAV);
 			squeak.clear();
 		}
 		else if (i->parameter == "CONFETTI")
 		{
-			particles.setEffect(CONFETTI);
+			particles.setEffect(ParticleField::CONFETTI);
 			squeak.clear();
 		}
 		else if (i->parameter == "CLEAR")
 		{
-			particles.setEffect(CLEAR);
+			particles.setEffect(ParticleField::CLEAR);
 			squeak.clear();
 		}
 		else if (i->parameter == "WIND")
 		{
-			particles.setEffect(WIND);
+			particles.setEffect(ParticleField::WIND);
 			// squeak.startWind();
 		}
 		else if (i->parameter == "POW")
 		{
-			particles.setEffect(POW);
+			particles.setEffect(ParticleField::POW);
 			squeak.clear();
 		}
 		else if (i->parameter == "VORTEX")
 		{
-			particles.setEffect(VORTEX);
+			particles.setEffect(ParticleField::VORTEX);
 			squeak.clear();
 		}
 		else
@@ -486,7 +780,11 @@ void GameImpl::refreshGame()
 		setCurrentNode("START");
 	}
 
+	// the answers in the history are from the old story
+	history.clear();
 	executeCommands (getCurrentNode()->commands);
+	// the lines of the answers may have moved, the old journal can't be replayed
+	startJournal();
 }
 
 void GameImpl::draw(const GraphicsContext &gc)
@@ -494,7 +792,7 @@ void GameImpl::draw(const GraphicsContext &gc)
 	al_clear_to_color(BLACK);
 	if (Engine::isDebug())
 	{
-		al_draw_text(Engine::getFont(), LIGHT_BLUE, 0, geth() - 16, ALLEGRO_ALIGN_LEFT, "DEBUG ON.     F5: REFRESH. F6: LOAD. F7: SAVE. F11: DEBUG OFF");
+		al_draw_text(Engine::getFont(), LIGHT_BLUE, 0, geth() - al_get_font_line_height(Engine::getFont()), ALLEGRO_ALIGN_LEFT, "DEBUG ON.     F5: REFRESH. F6: LOAD. F7: SAVE. F11: DEBUG OFF. F12: STATS");
 	}
 	particles.draw(gc);
 	text.draw(gc);
@@ -514,35 +812,61 @@ void AnswerComponent::draw (const GraphicsContext &gc)
 	int yco = y;
 	ALLEGRO_COLOR color = selected ? CYAN : LIGHT_GREY;
 	al_draw_text(Engine::getFont(), color, xco, yco, ALLEGRO_ALIGN_LEFT, answer.text.c_str());
-	if (selected) al_draw_text(Engine::getFont(), color, xco - 30, yco, ALLEGRO_ALIGN_LEFT, ">");
+	if (selected) al_draw_text(Engine::getFont(), color, xco - 30 * Simple::MainLoop::getMainLoop()->getScale(), yco, ALLEGRO_ALIGN_LEFT, ">");
+	Stats::add(Stats::DRAW_CALLS, selected ? 2 : 1);
 }
 
 void GameImpl::parse(string fname)
 {
 	auto parser = Parser::build();
 	story = parser->doParse(fname);
+	storyHash = SaveGame::hashStory(story);
 	interpreter = Interpreter::build(this, story);
 
 	gameAssert (parser->errorNum() == 0, parser->getErrors());
+
+	// rasterize all glyphs the story needs now, instead of during the animation
+	set<int32_t> codepoints;
+	collectCodepoints(story, codepoints);
+	prewarmGlyphs(fonts, codepoints);
 }
 
 void GameImpl::init(std::shared_ptr<Resources> res)
 {
 	text.setActiveFont(Engine::getFont());
 
+	// with native scaling, fonts are rendered at the display resolution
+	int s = Simple::MainLoop::getMainLoop()->getScale();
 	StyleData style;
-	style.bold = res->getFont("DejaVuSans-Bold")->get(16);
-	style.normal = res->getFont("DejaVuSans")->get(16);
-	style.bold = res->getFont("DejaVuSans-Bold")->get(16);
-	style.italic = res->getFont("DejaVuSans-Oblique")->get(16);
-	style.header = res->getFont("DejaVuSans-Bold")->get(24);
+	style.bold = res->getFont("DejaVuSans-Bold")->get(16 * s);
+	style.normal = res->getFont("DejaVuSans")->get(16 * s);
+	style.bold = res->getFont("DejaVuSans-Bold")->get(16 * s);
+	style.italic = res->getFont("DejaVuSans-Oblique")->get(16 * s);
+	style.header = res->getFont("DejaVuSans-Bold")->get(24 * s);
 
 	style.textColor = al_color_name("white");
 	style.linkColor = al_color_name("blue");
 
 	text.setStyle(style);
+	fonts = { Engine::getFont(), style.normal, style.bold, style.italic, style.header };
+	text.setAssets(Engine::getAssets());
+	Engine::getAssets()->setTargetWidth(text.getw());
+
+	ALLEGRO_CONFIG *config = Simple::MainLoop::getMainLoop()->getConfig();
+	Engine::getAssets()->setBudget(Assets::IMAGE, (size_t)get_config_int(config, "game", "image_budget_mb", 64) << 20);
+	Engine::getAssets()->setBudget(Assets::SAMPLE, (size_t)get_config_int(config, "game", "sound_budget_mb", 16) << 20);
+	Governor::setEnabled(get_config_int(config, "game", "governor", 1) != 0);
+	prefetchHops = get_config_int(config, "game", "prefetch_hops", 2);
+	autosave = autosave && get_config_int(config, "game", "autosave", 1) != 0;
+	compactEvery = max(1, get_config_int(config, "game", "journal_compact", 64));
+	historyDepth = max(0, get_config_int(config, "game", "undo_depth", 256));
+	if (autosave)
+	{
+		journal = make_unique<Journal>(Journal::getDefaultPath());
+	}
+	text.setRevealSpeed(get_config_int(config, "game", "text_speed", 50));
+	text.setScrollbackLimit(get_config_int(config, "game", "scrollback_kb", 1024) * 1024);
 
-	squeak.init();
 }
 
 
@@ -555,16 +879,58 @@ void GameImpl::executeCommands(vector<Command> commands)
 	vector<Answer> answerResult;
 	interpreter->executeStatements(sstate, answerResult, i, commands.end());
 
-	int xco = 100;
-	int yco = 560;
+	// the player is somewhere new, get ready for where they can go next.
+	if (!replaying) prefetchAround(sstate.currentNodeName, prefetchHops);
+
+	if (replaying || historyDepth == 0)
+	{
+		showAnswers(answerResult);
+		return;
+	}
+
+	auto answers = make_shared<const vector<Answer>>(move(answerResult));
+	history.push_back(Step { sstate, text.getPosition(), answers, activeEffect });
+	if (history.size() > historyDepth) history.pop_front();
+	showAnswers(*answers);
+}
+
+/** Go back steps choices, or as far as the history goes */
+void GameImpl::rewind(size_t steps)
+{
+	if (history.size() < 2) return;
+	steps = min(steps, history.size() - 1);
+	history.erase(history.end() - steps, history.end());
+
+	const Step &step = history.back();
+	sstate = step.state;
+	text.truncate(step.position);
+	if (step.effect != activeEffect)
+	{
+		// the initial "clear" isn't a story effect
+		Command effect(EFFECT, step.effect == "clear" ? "CLEAR" : step.effect, 0);
+		executeSideEffect(&effect);
+		activeEffect = step.effect;
+	}
+	showAnswers(*step.answers);
+	prefetchAround(sstate.currentNodeName, prefetchHops);
+	// the journal continues from here
+	startJournal();
+}
+
+void GameImpl::showAnswers(const vector<Answer> &answers)
+{
+	currentAnswers.clear();
+	int s = Simple::MainLoop::getMainLoop()->getScale();
+	int xco = 100 * s;
+	int yco = 560 * s;
 	bool first = true;
-	for (Answer a : answerResult)
+	for (const Answer &a : answers)
 	{
 		AnswerComponent comp;
 		comp.answer = a;
 		comp.setx(xco);
 		comp.sety(yco);
-		yco += 20;
+		yco += 20 * s;
 		comp.selected = first;
 		first = false;
 		currentAnswers.push_back(comp);
@@ -572,3 +938,41 @@ void GameImpl::executeCommands(vector<Command> commands)
 	selectedAnswer = currentAnswers.begin();
 
 }
+
+/**
+ * Walk the story graph along GOTO's (including those of answers) up to hops nodes away,
+ * and prefetch the images and samples found there. Everything else may be unloaded.
+ */
+void GameImpl::prefetchAround(const string &nodeName, int hops)
+{
+	vector<string> images;
+	vector<string> samples;
+	set<string> visited;
+	deque<pair<string, int>> todo;
+	todo.push_back({ nodeName, 0 });
+
+	while (!todo.empty())
+	{
+		auto [name, depth] = todo.front();
+		todo.pop_front();
+		if (!visited.insert(name).second) continue;
+
+		auto it = story.nodes.find(name);
+		if (it == story.nodes.end()) continue;
+
+		for (auto &cmd : it->second.commands)
+		{
+			switch (cmd.commandType)
+			{
+			case IMAGE: images.push_back(cmd.parameter); break;
+			case SAMPLE: samples.push_back(cmd.parameter); break;
+			case GOTO:
+				if (depth < hops) todo.push_back({ cmd.parameter, depth + 1 });
+				break;
+			default: break;
+			}
+		}
+	}
+
+	Engine::getAssets()->prefetch(images, samples);
+}
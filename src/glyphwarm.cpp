@@ -0,0 +1,60 @@
+#include "glyphwarm.h"
+#include "parser.h"
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_font.h>
+
+using namespace std;
+
+void collectCodepoints(const Story &story, set<int32_t> &result)
+{
+	// printable ascii is always needed, for answers and debug messages
+	for (int32_t cp = 32; cp < 127; ++cp)
+	{
+		result.insert(cp);
+	}
+
+	for (auto &node : story.nodes)
+	{
+		for (auto &cmd : node.second.commands)
+		{
+			if (cmd.commandType != TEXT && cmd.commandType != ANSWER) continue;
+
+			// markup is included as well, that does no harm.
+			ALLEGRO_USTR_INFO info;
+			const ALLEGRO_USTR *ustr = al_ref_buffer(&info, cmd.parameter.data(), cmd.parameter.size());
+			int pos = 0;
+			int32_t cp;
+			while ((cp = al_ustr_get_next(ustr, &pos)) != -1)
+			{
+				if (cp >= 32) result.insert(cp);
+			}
+		}
+	}
+}
+
+void prewarmGlyphs(const vector<ALLEGRO_FONT*> &fonts, const set<int32_t> &codepoints)
+{
+	ALLEGRO_USTR *ustr = al_ustr_new("");
+	for (int32_t cp : codepoints)
+	{
+		al_ustr_append_chr(ustr, cp);
+	}
+
+	// the glyph cache lives in video bitmaps, so this has to happen on the display thread.
+	ALLEGRO_BITMAP *scratch = al_create_bitmap(16, 16);
+	if (scratch)
+	{
+		ALLEGRO_STATE state;
+		al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+		al_set_target_bitmap(scratch);
+		for (ALLEGRO_FONT *font : fonts)
+		{
+			if (!font) continue;
+			al_draw_ustr(font, al_map_rgb(255, 255, 255), 0, 0, 0, ustr);
+		}
+		al_restore_state(&state);
+		al_destroy_bitmap(scratch);
+	}
+	al_ustr_free(ustr);
+}
@@ -0,0 +1,80 @@
+#include "governor.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+static const Governor::Level LEVELS[] = {
+	// particle density, effect scale, tile budget
+	{ 1.0f, 1.0f, 16 << 20 },
+	{ 0.6f, 1.0f, 12 << 20 },
+	{ 0.35f, 0.5f, 8 << 20 },
+	{ 0.2f, 0.5f, 4 << 20 },
+};
+static const int LEVEL_NUM = sizeof(LEVELS) / sizeof(LEVELS[0]);
+
+static const size_t WINDOW = 50; // frames
+static const double LATE = 1.5; // a frame is late if it came this many budgets after the previous one
+static const double MAX_LATE_RATIO = 0.1; // more late frames than this in a window: lower the quality
+static const double CALM = 0.5; // work below this part of the budget is headroom
+static const int CALM_WINDOWS = 3; // raise the quality after this many windows with headroom
+
+double Governor::budget = 20;
+bool Governor::enabled = true;
+int Governor::level = 0;
+int Governor::calmWindows = 0;
+vector<double> Governor::intervals;
+vector<double> Governor::works;
+
+void Governor::setEnabled(bool value)
+{
+	enabled = value;
+	if (!enabled) level = 0;
+}
+
+const Governor::Level &Governor::getSettings()
+{
+	return LEVELS[level];
+}
+
+void Governor::frame(double interval, double work)
+{
+	if (!enabled) return;
+	// after being idle, or a stall like dragging the window, the interval says nothing about the load.
+	if (interval > 250) return;
+
+	intervals.push_back(interval);
+	works.push_back(work);
+	if (intervals.size() < WINDOW) return;
+
+	size_t late = count_if(intervals.begin(), intervals.end(), [](double val) { return val > LATE * budget; });
+	nth_element(works.begin(), works.begin() + WINDOW * 9 / 10, works.end());
+	double work90 = works[WINDOW * 9 / 10];
+	intervals.clear();
+	works.clear();
+
+	if (late > MAX_LATE_RATIO * WINDOW)
+	{
+		calmWindows = 0;
+		if (level + 1 < LEVEL_NUM)
+		{
+			level++;
+			printf("Effect quality lowered to level %d: %d of %d frames late\n", level, (int)late, (int)WINDOW);
+		}
+	}
+	else if (work90 < CALM * budget)
+	{
+		calmWindows++;
+		if (calmWindows >= CALM_WINDOWS && level > 0)
+		{
+			level--;
+			calmWindows = 0;
+			printf("Effect quality raised to level %d\n", level);
+		}
+	}
+	else
+	{
+		calmWindows = 0;
+	}
+}
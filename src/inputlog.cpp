@@ -0,0 +1,139 @@
+#include "inputlog.h"
+
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+static const char *MAGIC = "twist-input";
+static const int VERSION = 1;
+
+bool InputLog::startRecording(const string &filename, int logicIntervalMsec)
+{
+	out.open(filename);
+	if (!out) return false;
+	out << MAGIC << " " << VERSION << " " << logicIntervalMsec << "\n";
+	recording = true;
+	return true;
+}
+
+void InputLog::record(int64_t tick, const ALLEGRO_EVENT &event)
+{
+	if (!recording) return;
+
+	switch (event.type)
+	{
+	case ALLEGRO_EVENT_KEY_DOWN:
+	case ALLEGRO_EVENT_KEY_UP:
+	case ALLEGRO_EVENT_KEY_CHAR: {
+		const ALLEGRO_KEYBOARD_EVENT &k = event.keyboard;
+		out << tick << " K " << k.type << " " << k.keycode << " " << k.unichar << " " << k.modifiers << " " << k.repeat << "\n";
+		break;
+	}
+	case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
+	case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
+	case ALLEGRO_EVENT_MOUSE_AXES: {
+		const ALLEGRO_MOUSE_EVENT &m = event.mouse;
+		out << tick << " M " << m.type << " " << m.x << " " << m.y << " " << m.z << " " << m.w << " "
+			<< m.dx << " " << m.dy << " " << m.dz << " " << m.dw << " " << m.button << "\n";
+		break;
+	}
+	case ALLEGRO_EVENT_TOUCH_BEGIN:
+	case ALLEGRO_EVENT_TOUCH_END:
+	case ALLEGRO_EVENT_TOUCH_MOVE:
+	case ALLEGRO_EVENT_TOUCH_CANCEL: {
+		const ALLEGRO_TOUCH_EVENT &t = event.touch;
+		out << tick << " T " << t.type << " " << t.id << " " << t.x << " " << t.y << " " << t.dx << " " << t.dy << " " << t.primary << "\n";
+		break;
+	}
+	case ALLEGRO_EVENT_DISPLAY_RESIZE:
+		out << tick << " R " << event.display.width << " " << event.display.height << "\n";
+		break;
+	default:
+		break;
+	}
+}
+
+void InputLog::stopRecording(int64_t tick)
+{
+	if (!recording) return;
+	out << tick << " E\n";
+	out.close();
+	recording = false;
+}
+
+bool InputLog::load(const string &filename, int logicIntervalMsec)
+{
+	ifstream in(filename);
+	if (!in) return false;
+
+	string magic;
+	int version = 0, interval = 0;
+	in >> magic >> version >> interval;
+	if (magic != MAGIC || version != VERSION)
+	{
+		cout << filename << " is not an input recording" << endl;
+		return false;
+	}
+	if (interval != logicIntervalMsec)
+	{
+		cout << "Warning: " << filename << " was recorded with a logic interval of " << interval << " msec, not " << logicIntervalMsec << endl;
+	}
+
+	events.clear();
+	next = 0;
+	endTick = -1;
+	string line;
+	getline(in, line); // rest of the header
+	while (getline(in, line))
+	{
+		istringstream ss(line);
+		int64_t tick;
+		char kind;
+		if (!(ss >> tick >> kind)) continue;
+
+		ALLEGRO_EVENT event = {};
+		switch (kind)
+		{
+		case 'K': {
+			ALLEGRO_KEYBOARD_EVENT &k = event.keyboard;
+			ss >> k.type >> k.keycode >> k.unichar >> k.modifiers >> k.repeat;
+			break;
+		}
+		case 'M': {
+			ALLEGRO_MOUSE_EVENT &m = event.mouse;
+			ss >> m.type >> m.x >> m.y >> m.z >> m.w >> m.dx >> m.dy >> m.dz >> m.dw >> m.button;
+			break;
+		}
+		case 'T': {
+			ALLEGRO_TOUCH_EVENT &t = event.touch;
+			ss >> t.type >> t.id >> t.x >> t.y >> t.dx >> t.dy >> t.primary;
+			break;
+		}
+		case 'R':
+			event.display.type = ALLEGRO_EVENT_DISPLAY_RESIZE;
+			ss >> event.display.width >> event.display.height;
+			break;
+		case 'E':
+			endTick = tick;
+			continue;
+		default:
+			continue;
+		}
+		if (!ss) continue;
+		events.push_back({ tick, event });
+	}
+
+	// a recording that was cut short ends with its last event
+	if (endTick < 0 && !events.empty()) endTick = events.back().first;
+	replaying = true;
+	return true;
+}
+
+bool InputLog::pop(int64_t tick, ALLEGRO_EVENT &event)
+{
+	if (next >= events.size() || events[next].first > tick) return false;
+	event = events[next].second;
+	next++;
+	return true;
+}
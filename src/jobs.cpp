@@ -0,0 +1,242 @@
+#include "jobs.h"
+#include "profiler.h"
+#include "stats.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// the job the current thread is running, if any
+static thread_local JobSystem::Job *currentJob = nullptr;
+// the worker the current thread is, -1 for other threads
+static thread_local int currentWorker = -1;
+
+JobSystem::Job::Job(function<void()> work, function<void()> completion, Priority priority) :
+	work(move(work)), completion(move(completion)), priority(priority), submitted(Profiler::now()), state(QUEUED), cancelled(false)
+{
+}
+
+JobSystem::JobSystem(int num) : nextWorker(0), queued(0), quit(false)
+{
+	al_init_user_event_source(&eventSource);
+#ifndef __EMSCRIPTEN__
+	// leave one core for the display thread
+	if (num <= 0) num = clamp(thread::hardware_concurrency(), 2u, 5u) - 1;
+	for (int i = 0; i < num; ++i)
+	{
+		workers.push_back(make_unique<Worker>());
+	}
+	for (int i = 0; i < num; ++i)
+	{
+		threads.push_back(thread(&JobSystem::work, this, i));
+	}
+#endif
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		lock_guard<mutex> guard(sleepMutex);
+		quit = true;
+	}
+	wakeup.notify_all();
+	for (auto &t : threads)
+	{
+		t.join();
+	}
+	al_destroy_user_event_source(&eventSource);
+}
+
+JobSystem::Handle JobSystem::submit(function<void()> work, Priority priority, function<void()> completion)
+{
+	Handle job = make_shared<Job>(move(work), move(completion), priority);
+	if (workers.empty())
+	{
+		// run from runCompletions()
+		queued++;
+		queueCompletion(job);
+		return job;
+	}
+
+	int index = currentWorker >= 0 ? currentWorker : (int)(nextWorker++ % workers.size());
+	{
+		lock_guard<mutex> guard(workers[index]->mutex);
+		workers[index]->queues[priority].push_back(job);
+	}
+	{
+		// under the lock, so a worker can't miss it between checking and going to sleep
+		lock_guard<mutex> guard(sleepMutex);
+		queued++;
+	}
+	wakeup.notify_one();
+	return job;
+}
+
+void JobSystem::cancel(const Handle &job)
+{
+	job->cancelled = true;
+	{
+		// if no worker took it yet, it never will. It is dropped when it comes up.
+		lock_guard<mutex> guard(sleepMutex);
+		int expected = Job::QUEUED;
+		job->state.compare_exchange_strong(expected, Job::CANCELLED);
+	}
+	finished.notify_all();
+}
+
+bool JobSystem::isCurrentCancelled()
+{
+	return currentJob && currentJob->cancelled;
+}
+
+void JobSystem::wait(const Handle &job)
+{
+	if (workers.empty())
+	{
+		while (job->state == Job::QUEUED)
+		{
+			runCompletions(0);
+		}
+		return;
+	}
+	unique_lock<mutex> lock(sleepMutex);
+	finished.wait(lock, [&job]() { return job->state != Job::QUEUED && job->state != Job::RUNNING; });
+}
+
+JobSystem::Handle JobSystem::take(int index)
+{
+	int num = workers.size();
+	for (int p = 0; p < PRIORITY_NUM; ++p)
+	{
+		// own queue first, oldest job first
+		{
+			Worker &own = *workers[index];
+			lock_guard<mutex> guard(own.mutex);
+			if (!own.queues[p].empty())
+			{
+				Handle job = own.queues[p].front();
+				own.queues[p].pop_front();
+				queued--;
+				return job;
+			}
+		}
+		// then steal the newest from the others, which their owner would get to last
+		for (int i = 1; i < num; ++i)
+		{
+			Worker &other = *workers[(index + i) % num];
+			lock_guard<mutex> guard(other.mutex);
+			if (!other.queues[p].empty())
+			{
+				Handle job = other.queues[p].back();
+				other.queues[p].pop_back();
+				queued--;
+				return job;
+			}
+		}
+	}
+	return nullptr;
+}
+
+void JobSystem::run(const Handle &job)
+{
+	int expected = Job::QUEUED;
+	if (!job->state.compare_exchange_strong(expected, Job::RUNNING)) return; // cancelled
+
+	uint64_t start = Profiler::now();
+	Profiler::record("job wait", job->submitted, start);
+	currentJob = job.get();
+	job->work();
+	currentJob = nullptr;
+	Profiler::record("job", start, Profiler::now());
+
+	bool complete = job->completion && !job->cancelled;
+	{
+		lock_guard<mutex> guard(sleepMutex);
+		job->state = complete ? Job::COMPLETING : Job::DONE;
+	}
+	finished.notify_all();
+	if (complete) queueCompletion(job);
+}
+
+void JobSystem::queueCompletion(const Handle &job)
+{
+	bool wasEmpty;
+	{
+		lock_guard<mutex> guard(completionMutex);
+		wasEmpty = completions.empty();
+		completions.push_back(job);
+	}
+	if (wasEmpty)
+	{
+		// the main loop may be asleep, waiting for events
+		ALLEGRO_EVENT event;
+		event.user.type = TWIST_JOBS_EVENT;
+		al_emit_user_event(&eventSource, &event, NULL);
+	}
+}
+
+void JobSystem::work(int index)
+{
+	currentWorker = index;
+	while (true)
+	{
+		Handle job = take(index);
+		if (job)
+		{
+			run(job);
+			continue;
+		}
+		unique_lock<mutex> lock(sleepMutex);
+		wakeup.wait(lock, [this]() { return quit || queued > 0; });
+		if (quit) return;
+	}
+}
+
+JobSystem::CompletionResult JobSystem::runCompletions(double budget)
+{
+	uint64_t start = Profiler::now();
+	uint64_t end = start + (uint64_t)(budget * 1e6);
+	int done = 0;
+	int ran = 0;
+	bool pending = false;
+	while (true)
+	{
+		Handle job;
+		{
+			lock_guard<mutex> guard(completionMutex);
+			if (completions.empty()) break;
+			job = completions.front();
+			completions.pop_front();
+		}
+		ran++;
+
+		if (job->state == Job::COMPLETING)
+		{
+			if (!job->cancelled)
+			{
+				PROFILE_SCOPE("completion");
+				job->completion();
+			}
+			job->state = Job::DONE;
+			done++;
+		}
+		else
+		{
+			// no threads: the work runs here too, and queues the completion after it.
+			queued--;
+			run(job);
+			if (job->isDone()) done++;
+		}
+
+		if (Profiler::now() >= end)
+		{
+			lock_guard<mutex> guard(completionMutex);
+			pending = !completions.empty();
+			break;
+		}
+	}
+
+	Stats::set(Stats::JOBS_QUEUED, queued);
+	Stats::add(Stats::JOBS_DONE, done);
+	return CompletionResult { ran, pending };
+}
@@ -0,0 +1,212 @@
+#include "journal.h"
+#include "savegame.h"
+#include "fileutil.h"
+
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+static const char JOURNAL_MAGIC[4] = { 'T', 'W', 'J', 'L' };
+static const uint32_t JOURNAL_VERSION = 1;
+
+static void putVarint(string &out, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+// returns false if the record is incomplete
+static bool getVarint(const string &data, size_t &pos, uint32_t &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 35 && pos < data.size(); shift += 7)
+	{
+		uint8_t b = data[pos++];
+		value |= (uint32_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+Journal::Journal(const string &path) : path(path), file(nullptr), snapshot(), records(), base(0), epoch(0)
+{
+}
+
+Journal::~Journal()
+{
+	close();
+}
+
+string Journal::getDefaultPath()
+{
+	return Path::getUserSettingsPath().join("journal.bin").toString();
+}
+
+// header and snapshot. Records follow.
+string Journal::encode(const string &snapshot)
+{
+	string out(JOURNAL_MAGIC, 4);
+	for (uint32_t value : { JOURNAL_VERSION, (uint32_t)snapshot.size() })
+	{
+		for (int i = 0; i < 4; ++i) out.push_back((char)(value >> (i * 8)));
+	}
+	out.append(snapshot);
+	return out;
+}
+
+void Journal::start(const string &snapshot, size_t first)
+{
+	lock_guard<mutex> guard(lockMutex);
+	this->snapshot = snapshot;
+	records.clear();
+	base = first;
+	epoch++;
+	// its snapshot is gone, records can't go there anymore
+	if (file) fclose(file);
+	file = nullptr;
+}
+
+bool Journal::write()
+{
+	lock_guard<mutex> fileGuard(fileMutex);
+	string newPath = path + ".new";
+
+	unique_lock<mutex> guard(lockMutex);
+	uint64_t written = epoch;
+	string data = encode(snapshot);
+	for (const string &record : records)
+	{
+		data.append(record);
+	}
+	size_t count = records.size();
+	guard.unlock();
+
+	bool ok = SaveGame::writeSynced(newPath, data);
+
+	guard.lock();
+	// a later start() or compact(), its own write() follows
+	if (epoch != written)
+	{
+		remove(newPath.c_str());
+		return true;
+	}
+	ok = ok && SaveGame::moveFile(newPath, path);
+	if (!ok)
+	{
+		cout << "Could not write " << path << endl;
+		remove(newPath.c_str());
+		return false;
+	}
+
+	if (file) fclose(file);
+	file = fopen(path.c_str(), "ab");
+	if (!file)
+	{
+		cout << "Could not open " << path << endl;
+		return false;
+	}
+	// appended while the file was written
+	for (size_t i = count; i < records.size(); ++i)
+	{
+		fwrite(records[i].data(), 1, records[i].size(), file);
+	}
+	fflush(file);
+	return true;
+}
+
+void Journal::append(const Choice &choice)
+{
+	string record;
+	putVarint(record, choice.index);
+	putVarint(record, choice.lineno);
+	record.push_back((char)SaveGame::crc32(record.data(), record.size()));
+
+	lock_guard<mutex> guard(lockMutex);
+	records.push_back(record);
+	if (!file) return;
+	// in the operating system's hands, so it survives the game crashing. Not flushed to disk, that's too slow.
+	bool ok = fwrite(record.data(), 1, record.size(), file) == record.size();
+	if (fflush(file) != 0 || !ok)
+	{
+		// a half written record ends the journal there. Kept in memory, the next write() has it.
+		cout << "Could not append to " << path << endl;
+		fclose(file);
+		file = nullptr;
+	}
+}
+
+uint64_t Journal::getEpoch()
+{
+	lock_guard<mutex> guard(lockMutex);
+	return epoch;
+}
+
+size_t Journal::getChoiceCount()
+{
+	lock_guard<mutex> guard(lockMutex);
+	return base + records.size();
+}
+
+size_t Journal::getRecordCount()
+{
+	lock_guard<mutex> guard(lockMutex);
+	return records.size();
+}
+
+bool Journal::compact(const string &snapshot, size_t first, uint64_t epoch)
+{
+	lock_guard<mutex> guard(lockMutex);
+	if (epoch != this->epoch || first < base || first > base + records.size()) return false;
+	records.erase(records.begin(), records.begin() + (first - base));
+	base = first;
+	this->snapshot = snapshot;
+	this->epoch++;
+	// the old file stays open, appends go there until write() replaces it
+	return true;
+}
+
+bool Journal::read(string &snapshot, vector<Choice> &choices)
+{
+	string data;
+	if (!SaveGame::readFile(path, data)) return false;
+	if (data.size() < 12 || memcmp(data.data(), JOURNAL_MAGIC, 4) != 0) return false;
+
+	auto u32 = [&data](size_t pos) {
+		const uint8_t *p = (const uint8_t*)data.data() + pos;
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	};
+	if (u32(4) != JOURNAL_VERSION) return false;
+	size_t snapshotSize = u32(8);
+	if (snapshotSize > data.size() - 12) return false;
+	snapshot = data.substr(12, snapshotSize);
+
+	// up to the first record that is incomplete or damaged
+	choices.clear();
+	size_t pos = 12 + snapshotSize;
+	while (pos < data.size())
+	{
+		size_t start = pos;
+		uint32_t index, lineno;
+		if (!getVarint(data, pos, index) || !getVarint(data, pos, lineno) || pos >= data.size()) break;
+		uint8_t check = (uint8_t)SaveGame::crc32(data.data() + start, pos - start);
+		if ((uint8_t)data[pos++] != check)
+		{
+			cout << "Journal damaged after " << choices.size() << " choices" << endl;
+			break;
+		}
+		choices.push_back(Choice { (int)index, (int)lineno });
+	}
+	return true;
+}
+
+void Journal::close()
+{
+	lock_guard<mutex> guard(lockMutex);
+	if (file) fclose(file);
+	file = nullptr;
+}
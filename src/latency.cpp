@@ -0,0 +1,95 @@
+#include "latency.h"
+#include "profiler.h"
+
+#include <allegro5/allegro.h>
+#include <cstdio>
+
+namespace {
+
+// a response slower than this is noticeable, and logged
+const double SLOW_MSEC = 100;
+
+const char *STAGE_NAMES[Latency::STAGE_NUM] = { "wait", "interpret", "layout", "assets", "present" };
+
+bool hasInput = false;
+uint64_t inputStart = 0; // when the input being handled arrived
+
+bool active = false; // a choice is being timed
+bool isShown = false;
+uint64_t start = 0;
+uint64_t since = 0; // start of the current stage
+Latency::Stage current = Latency::WAIT;
+uint64_t times[Latency::STAGE_NUM];
+
+}
+
+double Latency::last = -1;
+
+void Latency::input(double timestamp)
+{
+	uint64_t now = Profiler::now();
+	hasInput = true;
+	inputStart = now;
+	if (timestamp > 0)
+	{
+		// include the time the event spent in the queue
+		double queued = al_get_time() - timestamp;
+		if (queued > 0 && queued * 1e9 < now) inputStart = now - (uint64_t)(queued * 1e9);
+	}
+}
+
+void Latency::inputDone()
+{
+	hasInput = false;
+}
+
+void Latency::choice()
+{
+	// a previous choice whose response never appeared is dropped.
+	uint64_t now = Profiler::now();
+	active = true;
+	isShown = false;
+	start = hasInput ? inputStart : now;
+	for (auto &time : times) time = 0;
+	// the time until now is waiting, in whatever stage we're in
+	times[WAIT] = now - start;
+	since = now;
+}
+
+Latency::Stage Latency::enter(Stage stage)
+{
+	Stage prev = current;
+	if (active)
+	{
+		uint64_t now = Profiler::now();
+		times[current] += now - since;
+		since = now;
+	}
+	current = stage;
+	return prev;
+}
+
+void Latency::shown()
+{
+	if (active) isShown = true;
+}
+
+void Latency::presented(bool verbose)
+{
+	if (!active || !isShown) return;
+	enter(current);
+	active = false;
+
+	uint64_t total = 0;
+	for (auto time : times) total += time;
+	last = total / 1e6;
+	Profiler::record("choice", start, start + total);
+
+	if (!verbose && last < SLOW_MSEC) return;
+	printf("Choice latency %.1f ms:", last);
+	for (int i = 0; i < STAGE_NUM; ++i)
+	{
+		printf(" %s %.1f", STAGE_NAMES[i], times[i] / 1e6);
+	}
+	printf("\n");
+}
@@ -18,6 +18,15 @@ int main(int argc, const char *const *argv)
 	mainloop.setPreferredDisplayResolution(1024, 768);
 
 	mainloop.init(argc, argv);
-	engine->init();
-	mainloop.run();
+	int exitCode = 0;
+	if (engine->init(exitCode))
+	{
+		mainloop.run();
+	}
+	else
+	{
+		// saves the config, and stops the sound before the loop is destroyed
+		mainloop.shutdown();
+	}
+	return exitCode;
 }
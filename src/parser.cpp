@@ -7,6 +7,8 @@
 #include <iostream>
 #include <sstream>
 #include "color.h"
+#include "stats.h"
+#include "savegame.h"
 
 using namespace std;
 
@@ -297,7 +299,7 @@ public:
 			ss << "Variable: '" << key << "' not found!";
 			errors.push_back(ss.str());
 		}
-		return sstate.gameVariables[key];
+		return sstate.gameVariables.get(key);
 	}
 
 	//TODO: duplicate.
@@ -308,7 +310,7 @@ public:
 			ss << "Variable: '" << key << "' not found!";
 			errors.push_back(ss.str());
 		}
-		sstate.gameVariables[key] = val;
+		sstate.gameVariables.set(key, val);
 	}
 
 };
@@ -323,86 +325,9 @@ unique_ptr<Parser> Parser::build()
 	return unique_ptr<Parser>(new Parser());
 }
 
-Path saveFilePath()
-{
-	return Path::getUserSettingsPath().join("savedata");
-}
-
-//TODO: use temp and rename pattern?
-void SimpleState::save()
-{
-	Path path = saveFilePath();
-
-	ofstream outfile(path.toString(), ios::out | ios::trunc);
-
-	outfile << "NODE=" << currentNodeName << endl;
-
-	for (auto row : gameVariables)
-	{
-		outfile << row.first << "=" << row.second << endl;
-	}
-
-	outfile.close();
-}
-
-//TODO: use exceptions instead of bool return value.
-bool SimpleState::load()
-{
-	Path path = saveFilePath();
-
-	cout << path.toString() << endl;
-
-	ifstream infile(path.toString().c_str());
-
-	string line;
-	int lineno = 0;
-
-	bool error = false;
-	bool foundNode = false;
-
-	gameVariables.clear();
-
-	{
-		getline(infile, line);
-		lineno++;
-
-		auto fields = split(line, '=');
-
-		if (fields.size() != 2) {
-			error = true;
-		}
-		else if (fields[0] != "NODE") {
-			error = true;
-		}
-		else {
-			currentNodeName = fields[1];
-		}
-	}
-
-	if (error) return false;
-
-	//TODO: add a check that all variables are read, and none are skipped.
-	while (getline(infile, line))
-	{
-		lineno++;
-		line = trim(line);
-
-		auto fields = split(line, '=');
-
-		if (fields.size() != 2) {
-			error = true;
-			break;
-		}
-
-		gameVariables[fields[0]] = stoi(fields[1]);
-	}
-
-	return !error;
-}
-
 bool Interpreter::savedGameExists()
 {
-	return saveFilePath().fileExists();
+	return SaveGame::exists();
 }
 
 std::string Story::toString ()
@@ -745,6 +670,7 @@ public:
 	virtual void executeStatements(SimpleState &sstate, vector<Answer> &answerResult, vector<Command>::iterator &i, vector<Command>::iterator end) override;
 
 	virtual Answer executeAnswer(SimpleState &sstate, vector<Command>::iterator &i, vector<Command>::iterator end) override;
+	virtual bool findAnswer(SimpleState &sstate, int lineno, Answer &result) override;
 };
 
 unique_ptr<Interpreter> Interpreter::build(StatementHandler *handler, Story &story)
@@ -769,10 +695,9 @@ void InterpreterImpl::executeStatement(SimpleState &sstate, vector<Answer> &answ
 	case UNSET: {
 		if (i->parameter == "ALL")
 		{
-			for (map<string, int>::iterator i = sstate.gameVariables.begin(); i != sstate.gameVariables.end(); ++i)
-			{
-				i->second = 0;
-			}
+			sstate.gameVariables.forEach([&sstate](const string &key, int) {
+				sstate.gameVariables.set(key, 0);
+			});
 		}
 		else
 		{
@@ -803,7 +728,7 @@ int InterpreterImpl::getVar(const SimpleState &sstate, const string &key)
 	std::stringstream ss;
 	ss << "Variable: '" << key << "' not found!";
 	statementHandler->gameAssert (sstate.hasVar(key), ss.str());
-	return sstate.gameVariables.at(key);
+	return sstate.gameVariables.get(key);
 }
 
 void InterpreterImpl::setVar(SimpleState &sstate, const string &key, int val)
@@ -811,7 +736,7 @@ void InterpreterImpl::setVar(SimpleState &sstate, const string &key, int val)
 	std::stringstream ss;
 	ss << "Variable: '" << key << "' not found!";
 	statementHandler->gameAssert (sstate.hasVar(key), ss.str());
-	sstate.gameVariables[key] = val;
+	sstate.gameVariables.set(key, val);
 }
 
 void InterpreterImpl::setCurrentNode(SimpleState &sstate, const string &id)
@@ -830,6 +755,7 @@ void InterpreterImpl::executeStatements(SimpleState &sstate, vector<Answer> &ans
 {
 	while (i != end)
 	{
+		Stats::add(Stats::COMMANDS);
 		switch (i->commandType)
 		{
 		case ANSWER: {
@@ -856,10 +782,28 @@ void InterpreterImpl::executeStatements(SimpleState &sstate, vector<Answer> &ans
 }
 
 
+bool InterpreterImpl::findAnswer(SimpleState &sstate, int lineno, Answer &result)
+{
+	for (auto &pair : story.nodes)
+	{
+		vector<Command> &commands = pair.second.commands;
+		for (auto i = commands.begin(); i != commands.end(); ++i)
+		{
+			if (i->commandType == ANSWER && i->lineno == lineno)
+			{
+				result = executeAnswer(sstate, i, commands.end());
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
 Answer InterpreterImpl::executeAnswer(SimpleState &sstate, vector<Command>::iterator &i, vector<Command>::iterator end)
 {
 	Answer currentAnswer;
 	currentAnswer.text = i->parameter;
+	currentAnswer.lineno = i->lineno;
 	i++;
 
 	while (i != end)
@@ -0,0 +1,299 @@
+#include "particlefield.h"
+#include "simpleloop.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define PARTICLES_SSE
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+static const float TWO_PI = 6.2831853f;
+
+static const ALLEGRO_COLOR WHITES[] = { { 1, 1, 1, 1 }, { 0.85f, 0.9f, 1, 1 } };
+static const ALLEGRO_COLOR STARLIGHT[] = { { 1, 1, 1, 1 }, { 1, 1, 0.7f, 1 }, { 0.7f, 0.8f, 1, 1 } };
+static const ALLEGRO_COLOR FIRE[] = { { 1, 0.9f, 0.4f, 1 }, { 1, 0.6f, 0.1f, 1 }, { 1, 0.3f, 0.1f, 1 } };
+static const ALLEGRO_COLOR CYANS[] = { { 0.4f, 1, 1, 1 }, { 0.6f, 0.8f, 1, 1 } };
+static const ALLEGRO_COLOR CONFETTI_COLORS[] = { { 1, 0.2f, 0.2f, 1 }, { 0.2f, 1, 0.2f, 1 }, { 0.3f, 0.4f, 1, 1 }, { 1, 1, 0.2f, 1 }, { 1, 0.3f, 1, 1 } };
+static const ALLEGRO_COLOR GREYS[] = { { 0.8f, 0.8f, 0.8f, 1 }, { 0.6f, 0.6f, 0.6f, 1 } };
+static const ALLEGRO_COLOR PURPLES[] = { { 0.7f, 0.3f, 1, 1 }, { 0.4f, 0.4f, 1, 1 }, { 1, 0.5f, 1, 1 } };
+
+#define PALETTE(p) p, (int)(sizeof(p) / sizeof(p[0]))
+
+// indexed by Effect
+static const ParticleField::Params PARAMS[] = {
+	// rate, burst, gravity, wind, gust, swirl, pull, life, size, palette
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 0, PALETTE(WHITES) }, // CLEAR
+	{ 300, 0, 5, 0, 15, 0, 0, 14, 2.5, PALETTE(WHITES) }, // SNOW
+	{ 60, 200, 0, 0, 0, 0, 0, 30, 1.5, PALETTE(STARLIGHT) }, // STARS
+	{ 12, 0, 0, 0, 0, 0, 0, 4, 3, PALETTE(FIRE) }, // METEOR
+	{ 250, 0, -10, 0, 5, 0, 0, 12, 2, PALETTE(CYANS) }, // ANTIGRAV
+	{ 400, 0, 10, 0, 60, 0, 0, 10, 4, PALETTE(CONFETTI_COLORS) }, // CONFETTI
+	{ 400, 0, 0, 150, 80, 0, 0, 6, 1.5, PALETTE(GREYS) }, // WIND
+	{ 0, 2000, 200, 0, 0, 0, 0, 3, 3, PALETTE(FIRE) }, // POW
+	{ 400, 0, 0, 0, 0, 300, 60, 10, 2, PALETTE(PURPLES) }, // VORTEX
+};
+
+ParticleField::ParticleField(size_t capacity) : count(0), capacity(capacity),
+	effect(CLEAR), params(&PARAMS[CLEAR]), density(1.0), effectScale(1.0), pixelScale(1.0), layer(NULL), spawnDebt(0), time(0), seed(12345)
+{
+	// allocate everything up front
+	size_t padded = (capacity + 3) & ~(size_t)3;
+	for (auto *array : { &px, &py, &vx, &vy, &life, &size })
+	{
+		array->assign(padded, 0.0f);
+	}
+	color.assign(padded, ALLEGRO_COLOR { 0, 0, 0, 0 });
+	vertices.resize(capacity * 4);
+	indices.resize(capacity * 6);
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		const int quad[] = { 0, 1, 2, 0, 2, 3 };
+		for (int j = 0; j < 6; ++j) indices[i * 6 + j] = i * 4 + quad[j];
+	}
+}
+
+ParticleField::~ParticleField()
+{
+	if (layer) al_destroy_bitmap(layer);
+}
+
+// xorshift, deterministic so that replays look the same
+float ParticleField::random()
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return (seed >> 8) * (1.0f / 16777216.0f);
+}
+
+void ParticleField::setEffect(Effect value)
+{
+	// particles of the previous effect fly on, until they leave the screen or expire.
+	effect = value;
+	params = &PARAMS[value];
+	spawnDebt = 0;
+	time = 0;
+	spawn((int)(params->burst * density));
+}
+
+void ParticleField::spawn(int n)
+{
+	for (int i = 0; i < n && count < capacity; ++i)
+	{
+		spawnOne();
+	}
+}
+
+void ParticleField::spawnOne()
+{
+	size_t i = count++;
+	float xx = x, yy = y;
+	float dx = 0, dy = 0;
+	switch (effect)
+	{
+	case SNOW:
+	case CONFETTI:
+		xx = random(x, x + w);
+		yy = y - 5;
+		dx = random(-10, 10);
+		dy = random(20, 60);
+		break;
+	case STARS:
+		xx = random(x, x + w);
+		yy = random(y, y + h);
+		dx = random(-20, -5);
+		break;
+	case METEOR:
+		xx = random(x + w / 2, x + w + w / 2);
+		yy = y - 5;
+		dx = random(-350, -250);
+		dy = random(150, 250);
+		break;
+	case ANTIGRAV:
+		xx = random(x, x + w);
+		yy = y + h + 5;
+		dx = random(-5, 5);
+		dy = random(-40, -10);
+		break;
+	case WIND:
+		xx = x - 5;
+		yy = random(y, y + h);
+		dx = random(150, 350);
+		dy = random(-10, 10);
+		break;
+	case POW: {
+		float angle = random(0, TWO_PI);
+		float speed = random(50, 400);
+		xx = x + w / 2;
+		yy = y + h / 2;
+		dx = cosf(angle) * speed;
+		dy = sinf(angle) * speed;
+		break;
+	}
+	case VORTEX: {
+		// from anywhere on the edge of the screen
+		float angle = random(0, TWO_PI);
+		float radius = sqrtf(w * w + h * h) / 2;
+		xx = x + w / 2 + cosf(angle) * radius;
+		yy = y + h / 2 + sinf(angle) * radius;
+		dx = -sinf(angle) * 40;
+		dy = cosf(angle) * 40;
+		break;
+	}
+	case CLEAR:
+		break;
+	}
+	px[i] = xx;
+	py[i] = yy;
+	vx[i] = dx * pixelScale;
+	vy[i] = dy * pixelScale;
+	life[i] = params->life * random(0.7, 1.0);
+	size[i] = params->size * pixelScale * random(0.7, 1.3);
+	color[i] = params->palette[(int)(random() * params->paletteSize)];
+}
+
+// v += a * dt; p += v * dt, where a is the sum of gravity, wind and the vortex around (cx, cy)
+void ParticleField::integrate(float dt, float ax, float ay, float swirl, float pull, float cx, float cy)
+{
+	size_t i = 0;
+#ifdef PARTICLES_SSE
+	const __m128 vdt = _mm_set1_ps(dt);
+	const __m128 vax = _mm_set1_ps(ax);
+	const __m128 vay = _mm_set1_ps(ay);
+	const __m128 vswirl = _mm_set1_ps(swirl);
+	const __m128 vpull = _mm_set1_ps(pull);
+	const __m128 vcx = _mm_set1_ps(cx);
+	const __m128 vcy = _mm_set1_ps(cy);
+	const __m128 eps = _mm_set1_ps(100.0f); // keeps the force finite near the center
+	for (; i < count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&px[i]);
+		__m128 y = _mm_loadu_ps(&py[i]);
+		__m128 dx = _mm_sub_ps(x, vcx);
+		__m128 dy = _mm_sub_ps(y, vcy);
+		__m128 rinv = _mm_rsqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), eps));
+		__m128 fx = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), dy), vswirl), _mm_mul_ps(dx, vpull)), rinv);
+		__m128 fy = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dx, vswirl), _mm_mul_ps(dy, vpull)), rinv);
+
+		__m128 u = _mm_add_ps(_mm_loadu_ps(&vx[i]), _mm_mul_ps(_mm_add_ps(vax, fx), vdt));
+		__m128 v = _mm_add_ps(_mm_loadu_ps(&vy[i]), _mm_mul_ps(_mm_add_ps(vay, fy), vdt));
+		_mm_storeu_ps(&vx[i], u);
+		_mm_storeu_ps(&vy[i], v);
+		_mm_storeu_ps(&px[i], _mm_add_ps(x, _mm_mul_ps(u, vdt)));
+		_mm_storeu_ps(&py[i], _mm_add_ps(y, _mm_mul_ps(v, vdt)));
+		_mm_storeu_ps(&life[i], _mm_sub_ps(_mm_loadu_ps(&life[i]), vdt));
+	}
+#else
+	for (; i < count; ++i)
+	{
+		float dx = px[i] - cx;
+		float dy = py[i] - cy;
+		float rinv = 1.0f / sqrtf(dx * dx + dy * dy + 100.0f);
+		vx[i] += (ax + (-dy * swirl - dx * pull) * rinv) * dt;
+		vy[i] += (ay + (dx * swirl - dy * pull) * rinv) * dt;
+		px[i] += vx[i] * dt;
+		py[i] += vy[i] * dt;
+		life[i] -= dt;
+	}
+#endif
+}
+
+// expired, or off screen: replace by the last one
+void ParticleField::removeDead()
+{
+	float left = x - 20, right = x + w + 20, top = y - 20, bottom = y + h + 20;
+	size_t i = 0;
+	while (i < count)
+	{
+		if (life[i] > 0 && px[i] >= left && px[i] <= right && py[i] >= top && py[i] <= bottom)
+		{
+			i++;
+			continue;
+		}
+		count--;
+		px[i] = px[count];
+		py[i] = py[count];
+		vx[i] = vx[count];
+		vy[i] = vy[count];
+		life[i] = life[count];
+		size[i] = size[count];
+		color[i] = color[count];
+	}
+}
+
+void ParticleField::update()
+{
+	float dt = MSEC_FROM_TICKS(1) / 1000.0f;
+	time += dt;
+
+	// more particles on bigger screens, to keep the same density
+	float area = (float)w * h / (640.0f * 480.0f * pixelScale * pixelScale);
+	spawnDebt += params->rate * dt * area * density;
+	int n = (int)spawnDebt;
+	spawnDebt -= n;
+	spawn(n);
+
+	// the wind blows in gusts
+	float wind = params->wind + params->gust * sinf(time * 0.7f) * sinf(time * 1.9f + 1.0f);
+	float k = pixelScale;
+	integrate(dt, wind * k, params->gravity * k, params->swirl * k, params->pull * k, x + w / 2, y + h / 2);
+	removeDead();
+
+	Stats::set(Stats::PARTICLES, count);
+}
+
+void ParticleField::draw(const GraphicsContext &gc)
+{
+	if (count == 0) return;
+
+	// at reduced resolution, particles are drawn to a smaller layer, that is scaled up over the screen.
+	bool reduced = effectScale < 1.0f;
+	float k = reduced ? effectScale : 1.0f;
+	float ox = reduced ? -x : gc.xofst;
+	float oy = reduced ? -y : gc.yofst;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		float xx = (px[i] + ox) * k;
+		float yy = (py[i] + oy) * k;
+		float s = max(1.0f, size[i] * k);
+		// fade out during the last second
+		float alpha = min(1.0f, life[i]);
+		const ALLEGRO_COLOR &c = color[i];
+		ALLEGRO_COLOR faded = al_map_rgba_f(c.r * alpha, c.g * alpha, c.b * alpha, alpha);
+
+		ALLEGRO_VERTEX *v = &vertices[i * 4];
+		v[0] = { xx, yy, 0, 0, 0, faded };
+		v[1] = { xx + s, yy, 0, 0, 0, faded };
+		v[2] = { xx + s, yy + s, 0, 0, 0, faded };
+		v[3] = { xx, yy + s, 0, 0, 0, faded };
+	}
+
+	if (!reduced)
+	{
+		al_draw_indexed_prim(vertices.data(), NULL, NULL, indices.data(), count * 6, ALLEGRO_PRIM_TRIANGLE_LIST);
+		Stats::add(Stats::DRAW_CALLS);
+		return;
+	}
+
+	int lw = max(1, (int)(w * k));
+	int lh = max(1, (int)(h * k));
+	if (!layer || al_get_bitmap_width(layer) != lw || al_get_bitmap_height(layer) != lh)
+	{
+		if (layer) al_destroy_bitmap(layer);
+		layer = al_create_bitmap(lw, lh);
+		if (!layer) return;
+	}
+	ALLEGRO_BITMAP *target = al_get_target_bitmap();
+	al_set_target_bitmap(layer);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	al_draw_indexed_prim(vertices.data(), NULL, NULL, indices.data(), count * 6, ALLEGRO_PRIM_TRIANGLE_LIST);
+	al_set_target_bitmap(target);
+	al_draw_scaled_bitmap(layer, 0, 0, lw, lh, x + gc.xofst, y + gc.yofst, w, h, 0);
+	Stats::add(Stats::DRAW_CALLS, 2);
+}
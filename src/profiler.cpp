@@ -0,0 +1,225 @@
+#include "profiler.h"
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+using namespace std;
+
+namespace {
+
+// A slot of the ring, read by exportTrace while the owner may be writing it.
+// seq is odd while it is being written, and 2 * (n + 1) once it holds event number n.
+struct Event {
+	atomic<uint64_t> seq { 0 };
+	atomic<uint64_t> start { 0 };
+	atomic<uint64_t> end { 0 };
+	atomic<uint32_t> phase { 0 };
+};
+
+// Written only by the owning thread. Kept after the thread ends, so its events can still be exported.
+struct ThreadLog {
+	int tid;
+	atomic<uint64_t> head { 0 }; // total number of events written
+	Event events[Profiler::RING_SIZE];
+	atomic<uint32_t> hist[Profiler::MAX_PHASES][Profiler::BUCKETS] {};
+};
+
+atomic<const char *> phases[Profiler::MAX_PHASES] {};
+atomic<int> phaseNum { 0 };
+
+mutex logsMutex; // only taken when a thread records its first event, and by readers
+vector<unique_ptr<ThreadLog>> logs;
+
+// histogram totals at the start of the current window, and the counts of the last complete one.
+uint64_t windowStart[Profiler::MAX_PHASES][Profiler::BUCKETS];
+uint64_t window[Profiler::MAX_PHASES][Profiler::BUCKETS];
+
+thread_local ThreadLog *threadLog = nullptr;
+
+ThreadLog *getThreadLog()
+{
+	if (!threadLog)
+	{
+		auto log = make_unique<ThreadLog>();
+		lock_guard<mutex> guard(logsMutex);
+		log->tid = logs.size() + 1;
+		threadLog = log.get();
+		logs.push_back(move(log));
+	}
+	return threadLog;
+}
+
+int findPhase(const char *name)
+{
+	int n = phaseNum.load(memory_order_acquire);
+	for (int i = 0; i < n; ++i)
+	{
+		if (phases[i].load(memory_order_relaxed) == name) return i;
+	}
+
+	// new phase: claim the next free slot. Another thread may have added the same name in the meantime.
+	for (int i = n; i < Profiler::MAX_PHASES; ++i)
+	{
+		const char *expected = nullptr;
+		if (phases[i].compare_exchange_strong(expected, name) || expected == name)
+		{
+			int num = phaseNum.load();
+			while (num <= i && !phaseNum.compare_exchange_weak(num, i + 1)) {}
+			return i;
+		}
+	}
+	return -1;
+}
+
+// log-linear: four buckets per power of two
+int bucketOf(uint64_t ns)
+{
+	if (ns < 4) return ns;
+	int e = bit_width(ns) - 1;
+	int sub = (ns >> (e - 2)) & 3;
+	return min(e * 4 + sub, Profiler::BUCKETS - 1);
+}
+
+double bucketMid(int bucket)
+{
+	if (bucket < 4) return bucket;
+	int e = bucket / 4;
+	int sub = bucket % 4;
+	double width = (double)(1ull << (e - 2));
+	return (4 + sub) * width + width / 2;
+}
+
+}
+
+uint64_t Profiler::now()
+{
+	static const auto epoch = chrono::steady_clock::now();
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::record(const char *phase, uint64_t start, uint64_t end)
+{
+	int id = findPhase(phase);
+	if (id < 0) return;
+
+	ThreadLog *log = getThreadLog();
+	uint64_t head = log->head.load(memory_order_relaxed);
+	Event &event = log->events[head % RING_SIZE];
+	event.seq.store(2 * head + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	event.start.store(start, memory_order_relaxed);
+	event.end.store(end, memory_order_relaxed);
+	event.phase.store(id, memory_order_relaxed);
+	event.seq.store(2 * head + 2, memory_order_release);
+	log->head.store(head + 1, memory_order_release);
+	log->hist[id][bucketOf(end - start)].fetch_add(1, memory_order_relaxed);
+}
+
+void Profiler::nextWindow()
+{
+	static uint64_t total[MAX_PHASES][BUCKETS];
+	for (auto &row : total) for (auto &val : row) val = 0;
+
+	{
+		lock_guard<mutex> guard(logsMutex);
+		for (auto &log : logs)
+		{
+			for (int i = 0; i < MAX_PHASES; ++i)
+			{
+				for (int j = 0; j < BUCKETS; ++j)
+				{
+					total[i][j] += log->hist[i][j].load(memory_order_relaxed);
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < MAX_PHASES; ++i)
+	{
+		for (int j = 0; j < BUCKETS; ++j)
+		{
+			window[i][j] = total[i][j] - windowStart[i][j];
+			windowStart[i][j] = total[i][j];
+		}
+	}
+}
+
+double Profiler::percentile(const char *phase, double p)
+{
+	int id = -1;
+	int n = phaseNum.load(memory_order_acquire);
+	for (int i = 0; i < n; ++i)
+	{
+		if (phases[i].load(memory_order_relaxed) == phase) { id = i; break; }
+	}
+	if (id < 0) return -1;
+
+	uint64_t count = 0;
+	for (int j = 0; j < BUCKETS; ++j) count += window[id][j];
+	if (count == 0) return -1;
+
+	// rank of the requested sample, counting from 1
+	uint64_t rank = max<uint64_t>(1, (uint64_t)(p / 100.0 * count + 0.5));
+	uint64_t seen = 0;
+	for (int j = 0; j < BUCKETS; ++j)
+	{
+		seen += window[id][j];
+		if (seen >= rank) return bucketMid(j) / 1e6;
+	}
+	return bucketMid(BUCKETS - 1) / 1e6;
+}
+
+vector<const char *> Profiler::getPhases()
+{
+	vector<const char *> result;
+	int n = phaseNum.load(memory_order_acquire);
+	for (int i = 0; i < n; ++i)
+	{
+		const char *name = phases[i].load(memory_order_relaxed);
+		if (name) result.push_back(name);
+	}
+	return result;
+}
+
+bool Profiler::exportTrace(const string &filename)
+{
+	ofstream out(filename);
+	if (!out) return false;
+
+	out << fixed << setprecision(3) << "{\"traceEvents\":[\n";
+	bool first = true;
+	lock_guard<mutex> guard(logsMutex);
+	for (auto &log : logs)
+	{
+		// Other threads keep recording while this runs, and may overwrite the oldest events.
+		// An event is only used if its slot held that same event before and after copying it.
+		uint64_t head = log->head.load(memory_order_acquire);
+		uint64_t keep = min(head, (uint64_t)RING_SIZE);
+		for (uint64_t i = head - keep; i < head; ++i)
+		{
+			Event &slot = log->events[i % RING_SIZE];
+			uint64_t seq = slot.seq.load(memory_order_acquire);
+			if (seq != 2 * i + 2) continue;
+			uint64_t start = slot.start.load(memory_order_relaxed);
+			uint64_t end = slot.end.load(memory_order_relaxed);
+			uint32_t phase = slot.phase.load(memory_order_relaxed);
+			atomic_thread_fence(memory_order_acquire);
+			if (slot.seq.load(memory_order_relaxed) != seq) continue;
+
+			if (end < start || phase >= MAX_PHASES) continue;
+			const char *name = phases[phase].load(memory_order_relaxed);
+			if (!name) continue;
+
+			out << (first ? "" : ",\n") << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << log->tid
+				<< ",\"ts\":" << start / 1000.0 << ",\"dur\":" << (end - start) / 1000.0 << "}";
+			first = false;
+		}
+	}
+	out << "\n]}\n";
+	return out.good();
+}
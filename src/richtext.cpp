@@ -6,7 +6,6 @@
 #include "strutil.h"
 #include <allegro5/allegro_color.h>
 #include <allegro5/allegro_font.h>
-#include "text.h"
 #include "multiline.h"
 #include "openLink.h"
 
@@ -100,7 +99,7 @@ struct CallBackContext {
 	ALLEGRO_FONT *font;
 	ALLEGRO_COLOR color;
 	float line_height;
-	list<ComponentPtr> *components;
+	SegmentStore *segments;
 };
 
 bool cb(int line_num, float xflow, float yflow, const ALLEGRO_USTR *line, void *extra) {
@@ -111,31 +110,20 @@ bool cb(int line_num, float xflow, float yflow, const ALLEGRO_USTR *line, void *
 	float y = s->yoffset + yflow;
 
 	// TODO: line_num no longer needed, remove from callback?
-	al_draw_ustr(s->font, s->color, x, y, 0, line);
-
-	// constructor (char *, size) creates a copy of the substring.
-	std::string copy(al_cstr(line), al_ustr_size(line));
-
-	auto t = Text::build(s->color, 0, copy).font(s->font).xy(x, y).get();
-
+	// the segment store copies the substring into its own text arena.
 	if (s->span->type == TextSpan::TYPE_LINK) {
-		t->setDecoration(TextStyle::UNDERLINE);
 		string hrefcpy = s->span->href;
-		t->onClick([=](){ openLink(hrefcpy); });
+		s->segments->addLink(x, y, s->font, s->color, al_cstr(line), al_ustr_size(line), [=](){ openLink(hrefcpy); });
+	}
+	else {
+		s->segments->addText(x, y, s->font, s->color, al_cstr(line), al_ustr_size(line));
 	}
-	// else {
-	// 	string lcpy = string(al_cstr(line));
-	// 	t->onClick([=](){ cout << "Clicked on span with text " << lcpy << endl; });
-	// }
-
-	t->setVisible(false); // Specifically for animated text...
-	s->components->push_back(t);
 
 	return true;
 }
 
 void appendRichText(
-	const char *s, float *xflow, float *yflow, int iw, list<ComponentPtr> &components, const StyleData &style
+	const char *s, float *xflow, float *yflow, int iw, SegmentStore &segments, const StyleData &style
 ) {
 	list<TextSpan> spans;
 	spans = spansFromText(s);
@@ -143,7 +131,7 @@ void appendRichText(
 	for(auto &span : spans) {
 
 		CallBackContext ctx;
-		ctx.components = &components;
+		ctx.segments = &segments;
 	
 		ctx.xoffset = 0;
 		ctx.yoffset = 0;
@@ -0,0 +1,361 @@
+#include "savegame.h"
+#include "parser.h"
+#include "fileutil.h"
+#include "strutil.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char SAVE_MAGIC[4] = { 'T', 'W', 'S', 'V' };
+static const char *SAVE_FILE = "savegame.bin";
+// of earlier versions, in text: NODE=<id>, then <name>=<value> per variable
+static const char *LEGACY_FILE = "savedata";
+
+// one write at a time
+static mutex writeMutex;
+// of the save last written, guarded by writeMutex
+static uint64_t writtenGeneration = 0;
+static atomic<uint64_t> generations(0);
+
+static bool replaceFile(const string &path, const string &data);
+
+uint32_t SaveGame::crc32(const void *data, size_t len, uint32_t crc)
+{
+	static uint32_t table[256];
+	static once_flag tableInit;
+	call_once(tableInit, []() {
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k)
+			{
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+	});
+
+	const uint8_t *p = (const uint8_t*)data;
+	crc = ~crc;
+	for (size_t i = 0; i < len; ++i)
+	{
+		crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+uint32_t SaveGame::hashStory(const Story &story)
+{
+	uint32_t hash = 0;
+	for (const string &flag : story.flags)
+	{
+		hash = crc32(flag.c_str(), flag.size() + 1, hash);
+	}
+	for (auto &pair : story.nodes)
+	{
+		hash = crc32(pair.first.c_str(), pair.first.size() + 1, hash);
+	}
+	return hash;
+}
+
+static void putU32(string &out, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		out.push_back((char)(value >> (i * 8)));
+	}
+}
+
+static void putVarint(string &out, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+static void putString(string &out, const string &value)
+{
+	putVarint(out, value.size());
+	out.append(value);
+}
+
+string SaveGame::encode(const SimpleState &state, const vector<int> &answers, uint32_t storyHash)
+{
+	string out(SAVE_MAGIC, 4);
+	putU32(out, VERSION);
+	putU32(out, storyHash);
+	putString(out, state.currentNodeName);
+	putVarint(out, state.gameVariables.size());
+	state.gameVariables.forEach([&out](const string &name, int value) {
+		putString(out, name);
+		// zigzag, so small negative numbers stay small
+		putVarint(out, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+	});
+	putVarint(out, answers.size());
+	for (int line : answers)
+	{
+		putVarint(out, line);
+	}
+	putU32(out, crc32(out.data(), out.size()));
+	return out;
+}
+
+namespace {
+
+// reads from a buffer, failing once anything is out of bounds
+class Reader {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool ok;
+public:
+	Reader(const uint8_t *p, const uint8_t *end) : p(p), end(end), ok(true) {}
+	bool isOk() const { return ok; }
+	bool atEnd() const { return p == end; }
+
+	uint32_t u32()
+	{
+		if (end - p < 4) { ok = false; return 0; }
+		uint32_t value = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		p += 4;
+		return value;
+	}
+
+	uint64_t varint()
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (p == end) break;
+			uint8_t b = *p++;
+			value |= (uint64_t)(b & 0x7F) << shift;
+			if (!(b & 0x80)) return value;
+		}
+		ok = false;
+		return 0;
+	}
+
+	string str()
+	{
+		uint64_t len = varint();
+		if (!ok || len > (uint64_t)(end - p)) { ok = false; return string(); }
+		string value((const char*)p, len);
+		p += len;
+		return value;
+	}
+};
+
+}
+
+bool SaveGame::decode(const string &data, uint32_t storyHash, SimpleState &state, vector<int> &answers)
+{
+	if (data.size() < 4 + 4 + 4 + 4 || memcmp(data.data(), SAVE_MAGIC, 4) != 0) return false;
+
+	const uint8_t *begin = (const uint8_t*)data.data();
+	const uint8_t *body = begin + data.size() - 4;
+	if (Reader(body, body + 4).u32() != crc32(begin, body - begin)) return false;
+
+	Reader in(begin + 4, body);
+	if (in.u32() != VERSION) return false;
+	if (in.u32() != storyHash) return false;
+
+	SimpleState result;
+	result.currentNodeName = in.str();
+	uint64_t count = in.varint();
+	for (uint64_t i = 0; in.isOk() && i < count; ++i)
+	{
+		string name = in.str();
+		uint32_t zigzag = (uint32_t)in.varint();
+		result.gameVariables.set(name, (int)((zigzag >> 1) ^ (0u - (zigzag & 1))));
+	}
+	if (result.gameVariables.size() != count) return false;
+	vector<int> lines(in.isOk() ? min(in.varint(), (uint64_t)data.size()) : 0);
+	for (int &line : lines)
+	{
+		line = (int)in.varint();
+	}
+	// everything read, and nothing left over
+	if (!in.isOk() || !in.atEnd()) return false;
+
+	state = result;
+	answers = lines;
+	return true;
+}
+
+string SaveGame::getPath()
+{
+	return Path::getUserSettingsPath().join(SAVE_FILE).toString();
+}
+
+bool SaveGame::exists()
+{
+	Path dir = Path::getUserSettingsPath();
+	return dir.join(SAVE_FILE).fileExists() || dir.join(LEGACY_FILE).fileExists();
+}
+
+bool SaveGame::decodeLegacy(istream &in, SimpleState &state)
+{
+	SimpleState result;
+	string line;
+	if (!getline(in, line)) return false;
+	auto fields = split(trim(line), '=');
+	if (fields.size() != 2 || fields[0] != "NODE") return false;
+	result.currentNodeName = fields[1];
+
+	while (getline(in, line))
+	{
+		line = trim(line);
+		if (line.empty()) continue;
+		fields = split(line, '=');
+		if (fields.size() != 2) return false;
+		char *end;
+		long value = strtol(fields[1].c_str(), &end, 10);
+		if (fields[1].empty() || *end) return false;
+		result.gameVariables.set(fields[0], (int)value);
+	}
+
+	state = result;
+	return true;
+}
+
+// the first time a version with binary saves runs. The text file is left for older versions.
+static bool importLegacy(uint32_t storyHash, SimpleState &state)
+{
+	string path = Path::getUserSettingsPath().join(LEGACY_FILE).toString();
+	ifstream in(path);
+	if (!in) return false;
+	if (!SaveGame::decodeLegacy(in, state))
+	{
+		cout << path << " is not a valid save" << endl;
+		return false;
+	}
+	// the answers weren't saved, they are shown again by running the node
+	if (!SaveGame::write(SaveGame::encode(state, {}, storyHash), SaveGame::newGeneration()))
+	{
+		cout << "Could not convert " << path << endl;
+	}
+	return true;
+}
+
+uint64_t SaveGame::newGeneration()
+{
+	return ++generations;
+}
+
+bool SaveGame::write(const string &data, uint64_t generation)
+{
+	// the lock isn't taken in order, so an older save may get here last
+	lock_guard<mutex> guard(writeMutex);
+	if (generation < writtenGeneration) return true;
+	bool ok = replaceFile(getPath(), data);
+	if (ok) writtenGeneration = generation;
+	return ok;
+}
+
+bool SaveGame::writeFile(const string &path, const string &data)
+{
+	lock_guard<mutex> guard(writeMutex);
+	return replaceFile(path, data);
+}
+
+bool SaveGame::writeSynced(const string &path, const string &data)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f) return false;
+	bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+	ok = fflush(f) == 0 && ok;
+#ifdef _WIN32
+	ok = ok && _commit(_fileno(f)) == 0;
+#else
+	ok = ok && fsync(fileno(f)) == 0;
+#endif
+	ok = fclose(f) == 0 && ok;
+	return ok;
+}
+
+bool SaveGame::moveFile(const string &from, const string &to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+// called with writeMutex held
+static bool replaceFile(const string &path, const string &data)
+{
+	string tempPath = path + ".tmp";
+
+	// on disk before the rename, or a crash could leave an empty file under the real name
+	bool ok = SaveGame::writeSynced(tempPath, data);
+	ok = ok && SaveGame::moveFile(tempPath, path);
+#ifndef _WIN32
+	if (ok)
+	{
+		// and the rename itself
+		string dir = path.substr(0, path.find_last_of('/') + 1);
+		int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+		if (fd >= 0)
+		{
+			fsync(fd);
+			close(fd);
+		}
+	}
+#endif
+
+	if (!ok)
+	{
+		cout << "Failed to write " << path << endl;
+		remove(tempPath.c_str());
+	}
+	return ok;
+}
+
+bool SaveGame::readFile(const string &path, string &data)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f) return false;
+	data.clear();
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+	{
+		data.append(buf, n);
+	}
+	fclose(f);
+	return true;
+}
+
+bool SaveGame::load(uint32_t storyHash, SimpleState &state)
+{
+	string path = getPath();
+	string data;
+	if (!readFile(path, data)) return importLegacy(storyHash, state);
+
+	vector<int> answers;
+	if (!decode(data, storyHash, state, answers))
+	{
+		cout << path << " is not a valid save for this story" << endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,199 @@
+#include "segmentstore.h"
+#include "stats.h"
+#include "clip.h"
+
+#include <allegro5/allegro_font.h>
+#include <allegro5/allegro_primitives.h>
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+Segment &SegmentStore::add(Segment::Type type, int x, int y, int w, int h)
+{
+	Segment seg;
+	seg.type = type;
+	seg.x = x;
+	seg.y = y;
+	seg.w = w;
+	seg.h = h;
+	seg.color = al_map_rgba(0, 0, 0, 0);
+	seg.font = nullptr;
+	seg.textStart = text.size();
+	seg.textLen = 0;
+	seg.link = -1;
+	seg.glyphStart = glyphX.size();
+	seg.glyphCount = 1;
+	segments.push_back(seg);
+	return segments.back();
+}
+
+Segment &SegmentStore::addText(int x, int y, ALLEGRO_FONT *font, ALLEGRO_COLOR color, const char *s, size_t len)
+{
+	Segment &seg = add(Segment::TEXT, x, y, 0, al_get_font_line_height(font));
+	seg.font = font;
+	seg.color = color;
+	seg.textLen = len;
+	text.append(s, len);
+
+	// sum of advances, including kerning, is the same as al_get_ustr_width.
+	ALLEGRO_USTR_INFO info;
+	const ALLEGRO_USTR *ustr = al_ref_buffer(&info, s, len);
+	int pos = 0;
+	int right = 0;
+	int32_t cp = al_ustr_get_next(ustr, &pos);
+	while (cp >= 0)
+	{
+		int32_t next = al_ustr_get_next(ustr, &pos);
+		right += al_get_glyph_advance(font, cp, next >= 0 ? next : ALLEGRO_NO_KERNING);
+		glyphX.push_back(right);
+		cp = next;
+	}
+	seg.glyphCount = glyphX.size() - seg.glyphStart;
+	seg.w = right;
+	return seg;
+}
+
+Segment &SegmentStore::addLink(int x, int y, ALLEGRO_FONT *font, ALLEGRO_COLOR color, const char *s, size_t len, const function<void()> &onClick)
+{
+	Segment &seg = addText(x, y, font, color, s, len);
+	seg.type = Segment::LINK;
+	seg.link = links.size();
+	links.push_back(onClick);
+	return seg;
+}
+
+Segment &SegmentStore::addImage(int x, int y, ALLEGRO_BITMAP *bmp)
+{
+	Segment &seg = add(Segment::IMAGE, x, y, al_get_bitmap_width(bmp), al_get_bitmap_height(bmp));
+	seg.bmp = bmp;
+	return seg;
+}
+
+void SegmentStore::clear()
+{
+	segments.clear();
+	head = 0;
+	text.clear();
+	links.clear();
+	glyphX.clear();
+}
+
+void SegmentStore::popFront()
+{
+	assert (head < segments.size());
+	head++;
+	if (head >= 64 && head * 2 >= segments.size())
+	{
+		compact();
+	}
+}
+
+void SegmentStore::compact()
+{
+	segments.erase(segments.begin(), segments.begin() + head);
+	head = 0;
+
+	// text, glyphs and links are appended in segment order,
+	// so everything before the first live one is unused.
+	size_t textBase = text.size();
+	size_t glyphBase = glyphX.size();
+	int32_t linkBase = links.size();
+	for (auto &seg : segments)
+	{
+		if (seg.type == Segment::IMAGE) continue;
+		if (textBase == text.size())
+		{
+			textBase = seg.textStart;
+			glyphBase = seg.glyphStart;
+		}
+		if (seg.type == Segment::LINK)
+		{
+			linkBase = seg.link;
+			break;
+		}
+	}
+
+	text.erase(0, textBase);
+	glyphX.erase(glyphX.begin(), glyphX.begin() + glyphBase);
+	links.erase(links.begin(), links.begin() + linkBase);
+	for (auto &seg : segments)
+	{
+		if (seg.type == Segment::IMAGE) continue;
+		seg.textStart -= textBase;
+		seg.glyphStart -= glyphBase;
+		if (seg.type == Segment::LINK) seg.link -= linkBase;
+	}
+}
+
+size_t SegmentStore::firstOverlapping(int yy, int maxHeight) const
+{
+	// segments are appended in flow order, so they are sorted by y. Anything starting more than maxHeight above can be skipped.
+	auto it = lower_bound(begin(), end(), yy - maxHeight + 1, [](const Segment &seg, int val) {
+		return seg.y < val;
+	});
+	return it - begin();
+}
+
+void SegmentStore::click(const Segment &seg) const
+{
+	if (seg.type == Segment::LINK && links[seg.link])
+	{
+		links[seg.link]();
+	}
+}
+
+int SegmentStore::getGlyphRight(const Segment &seg, size_t n) const
+{
+	if (n >= seg.glyphCount) return seg.w;
+	if (n == 0) return 0;
+	return glyphX[seg.glyphStart + n - 1];
+}
+
+void SegmentStore::draw(const Segment &seg, int xofst, int yofst, size_t glyphs) const
+{
+	int xx = seg.x + xofst;
+	int yy = seg.y + yofst;
+
+	if (glyphs == 0) return;
+
+	// partially revealed: draw the whole run, clipped after the last revealed glyph
+	int saved[4];
+	bool partial = glyphs < seg.glyphCount;
+	int right = getGlyphRight(seg, glyphs);
+	if (partial)
+	{
+		al_get_clipping_rectangle(&saved[0], &saved[1], &saved[2], &saved[3]);
+		int cx, cy, cw, ch;
+		getClippingRectangle(&cx, &cy, &cw, &ch);
+		int clipRight = min(cx + cw, xx + right);
+		setClippingRectangle(cx, cy, max(0, clipRight - cx), ch);
+	}
+
+	switch (seg.type)
+	{
+	case Segment::IMAGE:
+		al_draw_bitmap(seg.bmp, xx, yy, 0);
+		Stats::add(Stats::DRAW_CALLS);
+		break;
+	case Segment::TEXT:
+	case Segment::LINK: {
+		ALLEGRO_USTR_INFO info;
+		al_draw_ustr(seg.font, seg.color, xx, yy, 0, al_ref_buffer(&info, getText(seg), seg.textLen));
+		Stats::add(Stats::DRAW_CALLS);
+		Stats::add(Stats::GLYPHS, seg.glyphCount); // the clipped ones are drawn too
+		if (seg.type == Segment::LINK)
+		{
+			float ly = yy + al_get_font_ascent(seg.font) + 1.5;
+			al_draw_line(xx, ly, xx + right, ly, seg.color, 1.0);
+			Stats::add(Stats::DRAW_CALLS);
+		}
+		break;
+	}
+	}
+
+	if (partial)
+	{
+		al_set_clipping_rectangle(saved[0], saved[1], saved[2], saved[3]);
+	}
+}
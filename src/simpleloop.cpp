@@ -10,12 +10,25 @@
 #include <allegro5/allegro_primitives.h>
 #include "textstyle.h"
 #include "container.h"
+#include "profiler.h"
+#include "stats.h"
+#include "inputlog.h"
+#include "latency.h"
+#include "governor.h"
 
 #include <iostream>
+#include <algorithm>
+#include <climits>
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#endif
 
 using namespace std;
 using namespace Simple;
 
+// main thread time per frame for finished background work, e.g. uploads to video memory
+static const double COMPLETION_BUDGET_MSEC = 2.0;
+
 MainLoop *MainLoop::instance = nullptr;
 
 MainLoop *MainLoop::getMainLoop()
@@ -47,13 +60,10 @@ MainLoop &MainLoop::setApp(const std::shared_ptr<IApp> &_app) {
 }
 
 MainLoop::MainLoop() :
-		buffer(nullptr), equeue(nullptr), logicTimer(nullptr), display(nullptr),
+		buffer(nullptr), screen(nullptr), equeue(nullptr), logicTimer(nullptr), display(nullptr),
 		app(nullptr), localAppData(nullptr), configPath(nullptr),
 		configFilename("twist.cfg"), title("untitled"), appname(nullptr),
 		prefGameSize(Point(640, 480)), prefDisplaySize(Point(-1, -1)), stretch (false), smokeTest(false), logicIntervalMsec(20),
-#ifdef USE_MONITORING
-		t0(), t1(), sums(), counts(),
-#endif
 		config(nullptr)
 {
 	w = 640;
@@ -75,11 +85,33 @@ MainLoop::MainLoop() :
 	instance = this;
 }
 
+const char *MainLoop::getScalingName(Scaling value)
+{
+	static const char *NAMES[SCALING_NUM] = { "blit", "transform", "native" };
+	return NAMES[value];
+}
+
+static bool parseScaling(const char *name, MainLoop::Scaling &result)
+{
+	for (int i = 0; i < MainLoop::SCALING_NUM; ++i)
+	{
+		if (strcmp(name, MainLoop::getScalingName((MainLoop::Scaling)i)) == 0)
+		{
+			result = (MainLoop::Scaling)i;
+			return true;
+		}
+	}
+	cout << "Unknown scaling '" << name << "', expected blit, transform or native" << endl;
+	return false;
+}
+
 void MainLoop::getFromConfig(ALLEGRO_CONFIG *config)
 {
 	_audio->getSoundFromConfig(config);
 	fpsOn = get_config_int (config, "twist", "fps", fpsOn);
 	screenMode = (ScreenMode)get_config_int (config, "twist", "windowed", screenMode);
+	const char *value = al_get_config_value(config, "twist", "scaling");
+	if (value) parseScaling(value, scaling);
 }
 
 void MainLoop::getFromArgs(int argc, const char *const *argv)
@@ -108,6 +140,50 @@ void MainLoop::getFromArgs(int argc, const char *const *argv)
 		{
 			smokeTest = true;
 		}
+		else if (strcmp (argv[i], "-benchmark") == 0)
+		{
+			benchmark = true;
+		}
+		else if (strcmp (argv[i], "-benchdisplay") == 0)
+		{
+			benchDisplay = true;
+		}
+		else if (strcmp (argv[i], "-scaling") == 0 && i + 1 < argc)
+		{
+			parseScaling(argv[++i], scaling);
+		}
+		else if (strcmp (argv[i], "-benchframes") == 0 && i + 1 < argc)
+		{
+			benchFrames = atoi(argv[++i]);
+		}
+		else if (strcmp (argv[i], "-benchsize") == 0 && i + 1 < argc)
+		{
+			int bw = 0, bh = 0;
+			if (sscanf(argv[++i], "%dx%d", &bw, &bh) == 2 && bw > 0 && bh > 0)
+			{
+				benchSize = Point(bw, bh);
+			}
+		}
+		else if (strcmp (argv[i], "-benchscale") == 0 && i + 1 < argc)
+		{
+			benchScale = max(1, atoi(argv[++i]));
+		}
+		else if (strcmp (argv[i], "-record") == 0 && i + 1 < argc)
+		{
+			recordFile = argv[++i];
+		}
+		else if (strcmp (argv[i], "-replay") == 0 && i + 1 < argc)
+		{
+			replayFile = argv[++i];
+		}
+		else if (strcmp (argv[i], "-stats") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (!Stats::openCsv(argv[i]))
+			{
+				cout << "Could not open " << argv[i] << " for writing" << endl;
+			}
+		}
 		else
 		{
 			options.push_back (string(argv[i]));
@@ -116,8 +192,34 @@ void MainLoop::getFromArgs(int argc, const char *const *argv)
 }
 
 
+void MainLoop::traceStartup(const string &phase)
+{
+	if (firstFrameDone) return;
+	auto now = chrono::steady_clock::now();
+	startupPhases.push_back({ phase, chrono::duration<double, milli>(now - startupLast).count() });
+	startupLast = now;
+}
+
+void MainLoop::reportStartup()
+{
+	traceStartup("first frame");
+	firstFrameDone = true;
+
+	double total = chrono::duration<double, milli>(startupLast - startupBegin).count();
+	cout << "Time to first frame: " << total << " ms (";
+	for (size_t i = 0; i < startupPhases.size(); ++i)
+	{
+		if (i > 0) cout << ", ";
+		cout << startupPhases[i].first << " " << startupPhases[i].second << " ms";
+	}
+	cout << ")" << endl;
+}
+
 int MainLoop::init(int argc, const char *const *argv)
 {
+	startupBegin = chrono::steady_clock::now();
+	startupLast = startupBegin;
+
 	// set default audio module if none was provided
 	if (!_audio) _audio = make_unique<Audio>();
 
@@ -126,6 +228,8 @@ int MainLoop::init(int argc, const char *const *argv)
 		allegro_message("al_init() failed");
 		return 1;
 	}
+	traceStartup("al_init");
+	jobs = make_unique<JobSystem>();
 
 	// initialise application name
 	if (appname == nullptr) {
@@ -169,8 +273,30 @@ int MainLoop::init(int argc, const char *const *argv)
 	getFromArgs (argc, argv);
 
 	parseOpts(options);
-	
-	if (!al_install_keyboard ())
+	traceStartup("config");
+
+	if (!replayFile.empty())
+	{
+		if (!inputLog.load(replayFile, logicIntervalMsec))
+		{
+			allegro_message("Could not load input recording");
+			return 1;
+		}
+	}
+	else if (!recordFile.empty())
+	{
+		if (!inputLog.startRecording(recordFile, logicIntervalMsec))
+		{
+			cout << "Could not open " << recordFile << " for recording" << endl;
+		}
+	}
+
+	if (benchmark)
+	{
+		// no window, no input, no sound
+		_audio->setInstalled(false);
+	}
+	else if (!al_install_keyboard ())
 	{
 		allegro_message("install keyboard failed");
 		return 1;
@@ -190,6 +316,7 @@ int MainLoop::init(int argc, const char *const *argv)
 	{
 		allegro_message ("Could not initialize primitives addon. ");
 	}
+	traceStartup("addons");
 
 	// set_volume_per_voice (1); //TODO
 	if (_audio->isInstalled())
@@ -211,11 +338,18 @@ int MainLoop::init(int argc, const char *const *argv)
 		}
 		_audio->init();
 	}
+	traceStartup("audio");
+
+	if (benchmark)
+	{
+		return initBenchmark();
+	}
 
 	if (initDisplay() == 0)
 	{
 		return 1;
 	}
+	traceStartup("display");
 
 #ifdef USE_MOUSE
 	if (!al_install_mouse())
@@ -362,190 +496,347 @@ int MainLoop::initDisplay()
 
 	al_set_target_backbuffer(display);
 
-	buffer = nullptr;
-
-	// use the first resolution as the primary game resolution.
-	// not necessarily the same size as the actual game resolution
-	if (stretch)
+	screen = al_get_backbuffer(display);
+	if (!initScaling())
 	{
-		buffer = al_create_bitmap(w, h);
+		allegro_message ("Error creating background buffer");
+		return 0;
 	}
 
-	if (!buffer)
+	if (title != nullptr)
 	{
-		buffer = al_get_backbuffer(display);
+		al_set_window_title (display, title);
 	}
 
-	if (!buffer)
+	return 1;
+}
+
+int MainLoop::initScaling()
+{
+	int sw = al_get_bitmap_width(screen);
+	int sh = al_get_bitmap_height(screen);
+	stretch = (sw != w || sh != h);
+	scale = 1;
+	buffer = screen;
+	if (!stretch) return 1;
+
+	if (scaling == SCALING_NATIVE)
 	{
-		allegro_message ("Error creating background buffer");
-		return 0;
+		if (useFixedResolution)
+		{
+			cout << "Native scaling needs a responsive app, using blit" << endl;
+			scaling = SCALING_BLIT;
+		}
+		else
+		{
+			// the app gets the whole screen, and draws everything larger by the same factor the others would scale by.
+			scale = max(1, min(sw / w, sh / h));
+			w = sw;
+			h = sh;
+			stretch = false;
+			return 1;
+		}
 	}
 
-	if (title != nullptr)
+	if (scaling == SCALING_BLIT)
 	{
-		al_set_window_title (display, title);
+		// use the first resolution as the primary game resolution.
+		// not necessarily the same size as the actual game resolution
+		buffer = al_create_bitmap(w, h);
 	}
+	// with SCALING_TRANSFORM, drawFrame sets up the transform on the screen.
+	return buffer != nullptr;
+}
 
-	return 1;
+void MainLoop::useScalingTransform()
+{
+	ALLEGRO_TRANSFORM t;
+	al_identity_transform(&t);
+	al_scale_transform(&t, (float)al_get_bitmap_width(screen) / w, (float)al_get_bitmap_height(screen) / h);
+	al_use_transform(&t);
 }
 
-#ifdef USE_MONITORING
-void MainLoop::logStartTime(const string &stage)
+// resume updates after being idle
+void MainLoop::wake()
 {
-	t2 = Clock::now();
+	if (!idle) return;
+	idle = false;
+	if (!benchmark) al_resume_timer(logicTimer);
 }
 
-void MainLoop::logEndTime(const string &stage)
+double MainLoop::getTime()
 {
-	//auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
-	auto t3 = Clock::now();
-	auto us0 = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t0);
-	auto us1 = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t1);
-	auto us2 = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2);
+	// ticks instead of the real time, so that recordings replay the same.
+	bool ticked = benchmark || inputLog.isRecording() || inputLog.isReplaying();
+	return ticked ? counter * logicIntervalMsec / 1000.0 : al_get_time();
+}
 
-	if (al_get_timer_count(logicTimer) > 10)
+void MainLoop::replayEvent(ALLEGRO_EVENT &event)
+{
+	wake();
+	needRedraw = true;
+	if (event.type == ALLEGRO_EVENT_DISPLAY_RESIZE)
 	{
-		if (counts.find(stage) == counts.end()) { counts[stage] = 0; }
-		if (sums.find(stage) == sums.end()) { sums[stage] = 0; }
-		counts[stage] ++;
-		sums[stage] += us2.count();
+		// resize for real, the display event follows as usual
+		if (display) al_resize_display(display, event.display.width, event.display.height);
+	}
+	else
+	{
+		Latency::input(0);
+		app->handleEvent(event);
+		Latency::inputDone();
+	}
+}
 
-		std::cout << "Cycle #" << al_get_timer_count(logicTimer) << " msecCounter: " << getMsecCounter() << "ms. Chrono: " << us0.count() << " us. Since cycle: " << us1.count() << "us. Phase: " << stage << ", duration: " << us2.count() << " us, avg: " << (sums[stage] / counts[stage]) << endl;
+// pass the recorded input that arrived before this tick to the app
+void MainLoop::replayInput()
+{
+	ALLEGRO_EVENT event;
+	bool any = false;
+	while (inputLog.pop(counter, event))
+	{
+		replayEvent(event);
+		any = true;
+	}
+
+	if (idle && !any && inputLog.pop(INT64_MAX, event))
+	{
+		// the app waits for input that was recorded later: the replay is out of step. Don't wait forever.
+		cout << "Replay out of step at tick " << counter << endl;
+		replayEvent(event);
+	}
+
+	if (inputLog.isDone() && (idle || counter >= inputLog.getEndTick()))
+	{
+		cout << "Replay finished after " << counter << " ticks" << endl;
+		quit = true;
 	}
 }
-#endif
 
-void MainLoop::pumpMessages()
+void MainLoop::logicUpdate()
 {
-	bool done = false;
-	bool need_redraw = true;
+	if (inputLog.isReplaying())
+	{
+		replayInput();
+		// while recording, the timer was stopped when idle. Ticks only count while busy.
+		if (idle || quit) return;
+	}
 
-	ALLEGRO_EVENT event;
-	while (!done)
+	UpdateResult result;
 	{
-		al_wait_for_event(equeue, &event);
+		PROFILE_SCOPE("update");
+		auto updateStart = chrono::steady_clock::now();
+		result = app->update();
+		frameWork += chrono::duration<double, milli>(chrono::steady_clock::now() - updateStart).count();
+	}
+	if (result == UPDATE_QUIT) {
+		quit = true;
+	}
+	else if (result == UPDATE_IDLE) {
+		// show the final state once, then sleep: nothing will happen until there is input.
+		if (!idle) needRedraw = true;
+		idle = true;
+		// a replay provides its own input, the timer keeps running to deliver it.
+		if (!benchmark && !inputLog.isReplaying()) al_stop_timer(logicTimer);
+	}
+	else {
+		needRedraw = true;
+	}
 
-		switch (event.type)
-		{
-			case ALLEGRO_EVENT_TIMER: {
-#ifdef USE_MONITORING
-				t1 = Clock::now();
-				logStartTime ("Update");
-#endif
-				if (!app->update()) {
-					done = true;
-				}
+	counter++;
+}
 
-				counter++;
-#ifdef USE_MONITORING
-				logEndTime ("Update");
-#endif
-				need_redraw = true;
-				break;
-			}
-			case ALLEGRO_EVENT_DISPLAY_CLOSE: {
-				done = true;
-				break;
-			}
-			case ALLEGRO_EVENT_DISPLAY_SWITCH_IN: {
-				app->handleEvent (event);
-				break;
-			}
-			case ALLEGRO_EVENT_DISPLAY_RESIZE: {
-				al_acknowledge_resize(event.display.source);
-				w = al_get_display_width(event.display.source);
-				h = al_get_display_height(event.display.source);
-				UpdateSize();
-				need_redraw = true;
-				break;
-			}
-			case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
-			case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
-			case ALLEGRO_EVENT_MOUSE_AXES: {
-				adjustMickey(event.mouse.x, event.mouse.y);
-				app->handleEvent (event);
+// completions may change what's on screen, e.g. show an image that was decoded
+void MainLoop::runCompletions()
+{
+	JobSystem::CompletionResult result = jobs->runCompletions(COMPLETION_BUDGET_MSEC);
+	if (result.ran > 0) needRedraw = true;
+	// nothing else may come along to run the rest
+	if (result.pending) wake();
+}
+
+void MainLoop::dispatchEvent(ALLEGRO_EVENT &event)
+{
+	// only there to wake up the loop, tick() runs the completions
+	if (event.type == TWIST_JOBS_EVENT) return;
+
+	// during a replay, the app gets the recorded input only
+	bool live = !inputLog.isReplaying();
+
+	// anything but a timer event is input, that may change what's on screen.
+	if (event.type != ALLEGRO_EVENT_TIMER)
+	{
+		if (live) wake();
+		needRedraw = true;
+		Latency::input(event.any.timestamp);
+	}
+
+	switch (event.type)
+	{
+		case ALLEGRO_EVENT_TIMER: {
+			logicUpdate();
+			break;
+		}
+		case ALLEGRO_EVENT_DISPLAY_CLOSE: {
+			quit = true;
+			break;
+		}
+		case ALLEGRO_EVENT_DISPLAY_SWITCH_IN: {
+			app->handleEvent (event);
+			break;
+		}
+		case ALLEGRO_EVENT_DISPLAY_RESIZE: {
+			inputLog.record(counter, event);
+			al_acknowledge_resize(event.display.source);
+			w = al_get_display_width(event.display.source);
+			h = al_get_display_height(event.display.source);
+			UpdateSize();
+			needRedraw = true;
+			break;
+		}
+		case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
+		case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
+		case ALLEGRO_EVENT_MOUSE_AXES: {
+			if (!live) break;
+			adjustMickey(event.mouse.x, event.mouse.y);
+			inputLog.record(counter, event);
+			app->handleEvent (event);
+			break;
+		}
+		case ALLEGRO_EVENT_TOUCH_BEGIN:
+		case ALLEGRO_EVENT_TOUCH_END:
+		case ALLEGRO_EVENT_TOUCH_MOVE:
+		case ALLEGRO_EVENT_TOUCH_CANCEL: {
+			if (!live) break;
+			adjustMickey(event.touch.x, event.touch.y); //TODO: cast needed?
+			inputLog.record(counter, event);
+			app->handleEvent (event);
+			break;
+		}
+		case ALLEGRO_EVENT_KEY_UP:
+		case ALLEGRO_EVENT_KEY_DOWN:
+			if (!live) break;
+			inputLog.record(counter, event);
+			app->handleEvent (event);
+			break;
+
+		case ALLEGRO_EVENT_KEY_CHAR: {
+			if (event.keyboard.keycode == ALLEGRO_KEY_F9) {
+				exportTrace();
 				break;
 			}
-			case ALLEGRO_EVENT_TOUCH_BEGIN:
-			case ALLEGRO_EVENT_TOUCH_END:
-			case ALLEGRO_EVENT_TOUCH_MOVE:
-			case ALLEGRO_EVENT_TOUCH_CANCEL: {
-				adjustMickey(event.touch.x, event.touch.y); //TODO: cast needed?
-				app->handleEvent (event);
+#ifdef DEBUG
+			if (event.keyboard.keycode == ALLEGRO_KEY_F10) {
+				quit = true;
 				break;
 			}
-			case ALLEGRO_EVENT_KEY_UP:
-			case ALLEGRO_EVENT_KEY_DOWN:
-				app->handleEvent (event);
-				break;
-
-			case ALLEGRO_EVENT_KEY_CHAR: {
-#ifdef DEBUG
-				if (event.keyboard.keycode == ALLEGRO_KEY_F10) {
-					done = true;
-					break;
-				}
 #endif
-				app->handleEvent (event);
+			if (!live) break;
+			inputLog.record(counter, event);
+			app->handleEvent (event);
 
-				break;
-			}
+			break;
 		}
+	}
+	Latency::inputDone();
+}
 
-		if (need_redraw && al_event_queue_is_empty(equeue))
-		{
-#ifdef USE_MONITORING
-			logStartTime ("Draw");
-#endif
-			GraphicsContext gc;
-			gc.buffer = buffer;
-			gc.xofst = 0;
-			gc.yofst = 0;
+// percentiles over the last second, one line per phase
+void MainLoop::drawProfile(int yy)
+{
+	int lineh = al_get_font_line_height(getFont());
+	for (const char *phase : Profiler::getPhases())
+	{
+		double p50 = Profiler::percentile(phase, 50);
+		if (p50 < 0) continue;
+		draw_textf_with_background(getFont(), WHITE, BLACK, 0, yy, ALLEGRO_ALIGN_LEFT,
+			"%-8s p50 %6.2f p95 %6.2f p99 %6.2f ms ", phase, p50, Profiler::percentile(phase, 95), Profiler::percentile(phase, 99));
+		yy += lineh;
+	}
+}
 
-			al_set_target_bitmap(buffer);
-			app->draw(gc);
-			need_redraw = false;
+void MainLoop::exportTrace()
+{
+	ALLEGRO_PATH *path = al_clone_path(localAppData);
+	al_set_path_filename(path, "trace.json");
+	string filename = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
+	al_destroy_path(path);
 
-	        int msecCounter = getMsecCounter();
+	if (Profiler::exportTrace(filename))
+	{
+		cout << "Trace written to " << filename << endl;
+	}
+	else
+	{
+		cout << "Could not write trace to " << filename << endl;
+	}
+}
 
-			if ((msecCounter - frame_counter) > 1000)
-			{
-				last_fps = frame_count;
-				frame_count = 0;
-				frame_counter = msecCounter;
-			}
-			frame_count++;
+void MainLoop::drawFrame()
+{
+	auto frameStart = chrono::steady_clock::now();
+	GraphicsContext gc;
+	gc.buffer = buffer;
+	gc.xofst = 0;
+	gc.yofst = 0;
+
+	al_set_target_bitmap(buffer);
+	if (stretch && scaling == SCALING_TRANSFORM) useScalingTransform();
+	{
+		PROFILE_SCOPE("draw");
+		app->draw(gc);
+	}
+	needRedraw = false;
 
-	        if (fpsOn && getFont())
-			{
-				draw_textf_with_background(getFont(), WHITE, BLACK, 0, 0,
-					  ALLEGRO_ALIGN_LEFT, "fps: %d msec: %07d ", last_fps, msecCounter);
-			}
+	int msecCounter = getMsecCounter();
+
+	if ((msecCounter - frame_counter) > 1000)
+	{
+		last_fps = frame_count;
+		frame_count = 0;
+		frame_counter = msecCounter;
+		Profiler::nextWindow();
+	}
+	frame_count++;
 
-	        if (stretch)
-	        {
-	    		// I tried using ALLEGRO_TRANSFORM instead of a separate buffer and using al_stretch_blit. But it's actually a lot slower.
- 	        	al_set_target_bitmap (al_get_backbuffer(display));
-	        	al_draw_scaled_bitmap(buffer, 0, 0, w, h, 0, 0, al_get_display_width(display), al_get_display_height(display), 0);
-	        }
+	if (fpsOn && getFont())
+	{
+		draw_textf_with_background(getFont(), WHITE, BLACK, 0, 0,
+			  ALLEGRO_ALIGN_LEFT, "fps: %d msec: %07d ", last_fps, msecCounter);
+		drawProfile(al_get_font_line_height(getFont()));
+	}
 
-			al_flip_display();
+	// vsync doesn't count as work. Benchmarks, recordings and replays keep the quality the same:
+	// it changes the particles, and with them when the game is idle, which a replay must reproduce.
+	double work = frameWork + chrono::duration<double, milli>(chrono::steady_clock::now() - frameStart).count();
+	bool governed = !isScripted() && !inputLog.isRecording();
+	if (governed && lastFrameStart != chrono::steady_clock::time_point())
+	{
+		Governor::frame(chrono::duration<double, milli>(frameStart - lastFrameStart).count(), work);
+	}
+	lastFrameStart = frameStart;
+	frameWork = 0;
 
-#ifdef USE_MONITORING
-			logEndTime ("Draw");
-#endif
-		}
+	PROFILE_SCOPE("present");
+	if (stretch && scaling == SCALING_BLIT)
+	{
+		// Transform used to be a lot slower than this blit, but that depends on the machine: compare with -benchmark -benchdisplay -scaling
+		al_set_target_bitmap (screen);
+		al_draw_scaled_bitmap(buffer, 0, 0, w, h, 0, 0, al_get_bitmap_width(screen), al_get_bitmap_height(screen), 0);
 	}
+	if (display)
+	{
+		LatencyScope vsync(Latency::PRESENT);
+		al_flip_display();
+	}
+	Latency::presented(fpsOn);
+	if (!firstFrameDone) reportStartup();
+	Stats::endFrame();
 }
 
-void MainLoop::run()
+void MainLoop::start()
 {
-#ifdef USE_MONITORING
-	t0 = Clock::now();
-#endif
 	assert (app); // must have initialised engine by now.
-	if (smokeTest) return;
 
 	// Start the event queue to handle keyboard input and our timer
 	equeue = al_create_event_queue();
@@ -561,28 +852,153 @@ void MainLoop::run()
 #endif
 	logicTimer = al_create_timer(logicIntervalMsec / 1000.0f);
 	al_start_timer(logicTimer);
+	Governor::setBudget(logicIntervalMsec);
 	al_register_event_source(equeue, al_get_timer_event_source(logicTimer));
+	al_register_event_source(equeue, jobs->getEventSource());
 
 	// send start event before anything else to component tree.
 	ALLEGRO_EVENT event;
 	event.type = TWIST_START_EVENT;
 	app->handleEvent(event);
+	needRedraw = true;
+	quit = false;
+}
 
-	pumpMessages();
+bool MainLoop::tick()
+{
+	// handle everything that is pending, without waiting.
+	ALLEGRO_EVENT event;
+	while (!quit && al_get_next_event(equeue, &event))
+	{
+		dispatchEvent(event);
+	}
+	runCompletions();
 
+	if (!quit && needRedraw)
+	{
+		drawFrame();
+	}
+	return !quit;
+}
+
+void MainLoop::shutdown()
+{
 	// cleanup
+	inputLog.stopRecording(counter);
 	if (configFilename != nullptr)
 	{
 		al_save_config_file(al_path_cstr(configPath, ALLEGRO_NATIVE_PATH_SEP), config);
 	}
 
+	Stats::closeCsv();
+
 	// stop sound - important that this is done before the ALLEGRO_AUDIO_STREAM resources are destroyed
 	_audio->done();
 }
 
+#ifdef __EMSCRIPTEN__
+static void tickCallback(void *arg)
+{
+	MainLoop *mainLoop = (MainLoop*)arg;
+	if (!mainLoop->tick())
+	{
+		emscripten_cancel_main_loop();
+		mainLoop->shutdown();
+	}
+}
+#endif
+
+int MainLoop::initBenchmark()
+{
+	if (benchDisplay)
+	{
+		// as fast as it goes, so the frame times say something
+		al_set_new_display_option(ALLEGRO_VSYNC, 2, ALLEGRO_SUGGEST);
+		if (initDisplay() == 0) return 1;
+	}
+	else
+	{
+		// there is no display, so everything is a memory bitmap
+		al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+		w = benchSize.x();
+		h = benchSize.y();
+		screen = al_create_bitmap(w * benchScale, h * benchScale);
+		if (!screen || !initScaling())
+		{
+			cout << "Could not create benchmark target of " << w * benchScale << "x" << h * benchScale << endl;
+			return 1;
+		}
+	}
+
+	// never started, the benchmark advances it one tick at a time.
+	logicTimer = al_create_timer(logicIntervalMsec / 1000.0f);
+	traceStartup("display");
+	return 0;
+}
+
+void MainLoop::runBenchmark()
+{
+	ALLEGRO_EVENT event;
+	event.type = TWIST_START_EVENT;
+	app->handleEvent(event);
+
+	// every frame is one logic tick and one draw, as fast as possible.
+	// When replaying, by default until the recording ends.
+	int frames = benchFrames >= 0 ? benchFrames : (inputLog.isReplaying() ? INT_MAX : 600);
+	vector<double> frameMsec;
+	auto begin = chrono::steady_clock::now();
+	for (int i = 0; i < frames; ++i)
+	{
+		auto frameBegin = chrono::steady_clock::now();
+		al_add_timer_count(logicTimer, 1);
+		logicUpdate();
+		if (quit) break;
+		runCompletions();
+		drawFrame();
+		frameMsec.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - frameBegin).count());
+	}
+	double total = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+
+	if (frameMsec.empty()) return;
+	vector<double> sorted = frameMsec;
+	sort(sorted.begin(), sorted.end());
+	auto at = [&](double p) { return sorted[min(sorted.size() - 1, (size_t)(p / 100.0 * sorted.size()))]; };
+	printf("Benchmark: %d frames at %dx%d on %dx%d, %s scaling, in %.1f ms (%.1f fps)\n",
+		(int)sorted.size(), w, h, al_get_bitmap_width(screen), al_get_bitmap_height(screen),
+		getScalingName(scaling), total, sorted.size() * 1000.0 / total);
+	printf("Frame time ms: mean %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+		total / sorted.size(), at(50), at(95), at(99), sorted.back());
+}
+
+void MainLoop::run()
+{
+	if (smokeTest) return;
+	if (benchmark)
+	{
+		runBenchmark();
+		// closes a recording with its end tick, and saves the config
+		shutdown();
+		return;
+	}
+	start();
+
+#ifdef __EMSCRIPTEN__
+	// the browser drives the loop, once per animation frame. This call doesn't return.
+	emscripten_set_main_loop_arg(tickCallback, this, 0, true);
+#else
+	while (tick())
+	{
+		// sleep until something happens, leaving the event in the queue for tick()
+		al_wait_for_event(equeue, NULL);
+	}
+	shutdown();
+#endif
+}
+
 MainLoop::~MainLoop() {
 	// clear main components immediately
 	app = nullptr;
+	jobs = nullptr;
 
 	if (localAppData)
 		al_destroy_path(localAppData);
@@ -591,6 +1007,11 @@ MainLoop::~MainLoop() {
 		al_destroy_path(configPath);
 
 //	if (buffer) al_destroy_bitmap (buffer); //TODO / not usually necessary?
+	if (benchmark && !display)
+	{
+		if (buffer != screen) al_destroy_bitmap(buffer);
+		if (screen) al_destroy_bitmap(screen);
+	}
 
 	if (logicTimer) al_destroy_timer(logicTimer);
 	if (equeue) al_destroy_event_queue(equeue);
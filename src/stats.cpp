@@ -0,0 +1,155 @@
+#include "stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+namespace {
+
+struct CounterInfo {
+	const char *name;
+	bool perFrame;
+};
+
+const CounterInfo INFO[Stats::COUNTER_NUM] = {
+	{ "draw_calls", true },
+	{ "glyphs", true },
+	{ "segments", false },
+	{ "particles", false },
+	{ "bitmaps", false },
+	{ "bitmap_bytes", false },
+	{ "allocs", true },
+	{ "alloc_bytes", true },
+	{ "commands", true },
+	{ "jobs_queued", false },
+	{ "jobs_done", true },
+};
+
+// constant initialized, so safe to use from operator new during static initialization
+atomic<int64_t> current[Stats::COUNTER_NUM];
+int64_t last[Stats::COUNTER_NUM];
+
+FILE *csv = nullptr;
+int64_t frame = 0;
+chrono::steady_clock::time_point lastFrameTime;
+
+}
+
+void Stats::add(Counter counter, int64_t n)
+{
+	current[counter].fetch_add(n, memory_order_relaxed);
+}
+
+void Stats::set(Counter counter, int64_t value)
+{
+	current[counter].store(value, memory_order_relaxed);
+}
+
+int64_t Stats::get(Counter counter)
+{
+	return last[counter];
+}
+
+const char *Stats::getName(Counter counter)
+{
+	return INFO[counter].name;
+}
+
+void Stats::endFrame()
+{
+	for (int i = 0; i < COUNTER_NUM; ++i)
+	{
+		last[i] = INFO[i].perFrame ? current[i].exchange(0, memory_order_relaxed) : current[i].load(memory_order_relaxed);
+	}
+
+	auto now = chrono::steady_clock::now();
+	double frameMsec = frame == 0 ? 0 : chrono::duration<double, milli>(now - lastFrameTime).count();
+	lastFrameTime = now;
+
+	if (csv)
+	{
+		fprintf(csv, "%lld,%.3f", (long long)frame, frameMsec);
+		for (int i = 0; i < COUNTER_NUM; ++i)
+		{
+			fprintf(csv, ",%lld", (long long)last[i]);
+		}
+		fputc('\n', csv);
+	}
+	frame++;
+}
+
+bool Stats::openCsv(const string &filename)
+{
+	closeCsv();
+	csv = fopen(filename.c_str(), "w");
+	if (!csv) return false;
+
+	fprintf(csv, "frame,frame_ms");
+	for (int i = 0; i < COUNTER_NUM; ++i)
+	{
+		fprintf(csv, ",%s", INFO[i].name);
+	}
+	fputc('\n', csv);
+	return true;
+}
+
+void Stats::closeCsv()
+{
+	if (csv) fclose(csv);
+	csv = nullptr;
+}
+
+#ifdef TWIST_ALLOC_STATS
+
+// count every allocation. The aligned variants aren't used by this code base and keep their defaults.
+
+void *operator new(size_t size)
+{
+	Stats::add(Stats::ALLOCS);
+	Stats::add(Stats::ALLOC_BYTES, size);
+	if (size == 0) size = 1;
+	while (true)
+	{
+		void *p = malloc(size);
+		if (p) return p;
+		// as the standard operator new: the handler may free some memory, and we try again
+		new_handler handler = get_new_handler();
+		if (!handler) throw bad_alloc();
+		handler();
+	}
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const nothrow_t &) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (const bad_alloc &)
+	{
+		return nullptr;
+	}
+}
+
+void *operator new[](size_t size, const nothrow_t &tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, const nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const nothrow_t &) noexcept { free(p); }
+
+#endif
@@ -4,57 +4,125 @@
 #include <allegro5/allegro_audio.h>
 #include <cstdio>
 #include <iostream>
-#include "text.h"
+#include <algorithm>
 #include "text2.h"
+#include "stats.h"
+#include "clip.h"
+#include "latency.h"
+#include "simpleloop.h"
 
 using namespace std;
 
-class ComponentRemover
+// segments that are further than this above the view are forgotten, and laid out again when needed.
+static const int MATERIALIZE_MARGIN = 400;
+
+TextCanvas::~TextCanvas()
 {
-public:
-	bool operator()(ComponentPtr &p)
-	{
-		if (!p->isAlive())
-		{
-			return true;
-		}
-		return false;
-	}
-};
+	// the asset cache outlives the canvas, the images on screen would stay pinned in it
+	if (assets) releaseImages();
+}
 
 void TextCanvas::clear()
 {
+	releaseImages();
+	transcript.clear();
 	lines.clear();
-	cursor = lines.begin();
+	matFirst = 0;
+	matLast = 0;
+	matSegBase = 0;
+	segTotal = 0;
+	revealed = 0;
+	revealEntry = 0;
+	cursorGlyphs = 0;
+	revealBudget = 0;
 	activeColor = WHITE;
 	yoffset = 0;
+	tailOffset = 0;
 	xco = 0;
 	yco = 0;
+	tileCache.clear();
+	sealedY = 0;
+	contentWidth = 0;
 }
 
-void TextCanvas::startAnimationAtCursor()
+void TextCanvas::truncate(size_t pos)
 {
-	(*cursor)->setVisible(true);
+	if (pos >= transcript.end()) return;
+	if (pos <= transcript.begin())
+	{
+		clear();
+		return;
+	}
 
-	shared_ptr<Text> textSegment = dynamic_pointer_cast<Text>(*cursor);
-	if (textSegment)
+	releaseImages();
+	lines.clear();
+	matFirst = matLast = transcript.end();
+
+	// the flow continues where the first removed entry started
+	xco = transcript[pos].x;
+	yco = transcript[pos].y;
+	segTotal = transcript[pos].segStart;
+	while (transcript.end() > pos)
 	{
-		if (!speedUp)
-		{
-			textSegment->startTypewriter(Text::LETTER_BY_LETTER);
-			waitForAnimationDone = true;
-		}
+		transcript.popBack();
 	}
+
+	if (revealed >= segTotal)
+	{
+		revealed = segTotal;
+		revealEntry = pos;
+		cursorGlyphs = 0;
+	}
+	revealBudget = 0;
+
+	// the tiles may show text that is gone
+	tileCache.clear();
+	sealedY = 0;
+	tailOffset = min(tailOffset, max(0, yco - (y + h)));
+	yoffset = tailOffset;
+	rebuild(min(transcript.firstOverlapping(yoffset - MATERIALIZE_MARGIN), revealEntry), transcript.end());
+}
+
+void TextCanvas::setActiveFont(ALLEGRO_FONT *font)
+{
+	assert (font != NULL);
+	activeFont = font;
+	growLineHeight(al_get_font_line_height(font));
 }
 
-void TextCanvas::handleMessage(ComponentPtr src, int msg)
+// reveal as many glyphs as the elapsed time allows, possibly spanning several segments.
+// Glyph positions are known from layout, so this is only a matter of counting.
+void TextCanvas::advanceCursor(double elapsed)
 {
-	// if we receive a message that the current segment is done animating
-	if (msg == MSG_ANIMATION_DONE)
+	revealBudget += elapsed * revealSpeed;
+	size_t startSeg = revealed;
+	size_t startGlyphs = cursorGlyphs;
+	while (revealed < segTotal && revealed < matSegBase + lines.size())
 	{
-		// advance to next segment
-		waitForAnimationDone = false;
+		const Segment &seg = lines[revealed - matSegBase];
+		size_t remaining = seg.glyphCount - cursorGlyphs;
+		if (speedUp || seg.type == Segment::IMAGE)
+		{
+			// at least a whole segment at a time
+			revealBudget = max(revealBudget, (double)remaining);
+		}
+		if (revealBudget < remaining)
+		{
+			cursorGlyphs += (size_t)revealBudget;
+			revealBudget -= (size_t)revealBudget;
+			break;
+		}
+
+		revealBudget -= remaining;
+		revealed++;
+		cursorGlyphs = 0;
+		while (revealEntry < transcript.end() && revealed >= transcript[revealEntry].segStart + transcript[revealEntry].segCount)
+		{
+			revealEntry++;
+		}
+		if (speedUp) break;
 	}
+	if (revealed != startSeg || cursorGlyphs != startGlyphs) Latency::shown();
 }
 
 void TextCanvas::update()
@@ -62,53 +130,220 @@ void TextCanvas::update()
 	busy = 0; // 1 = busy, 0 = ready
 	//TODO: better system would be to send event when busy state changes.
 
-	if (cursor == lines.end())
+	// reveal speed is independent of the logic rate
+	double now = Simple::MainLoop::getMainLoop()->getTime();
+	// after a stall (e.g. loading, dragging the window), don't dump a whole paragraph at once.
+	double elapsed = (lastUpdateTime < 0) ? 0 : min(now - lastUpdateTime, 0.25);
+	lastUpdateTime = now;
+
+	bool materialized = revealed >= matSegBase && revealed < matSegBase + lines.size();
+	if (revealed < segTotal)
+	{
+		busy = 1;
+		// while the player is reading back, new text waits.
+		if (isFollowing() && materialized)
+		{
+			advanceCursor(elapsed);
+			materialized = revealed < matSegBase + lines.size();
+		}
+	}
+	else
+	{
+		// don't save up time for the next text
+		revealBudget = 0;
+	}
+
+	// everything above the segment that is currently appearing is final
+	if (revealed >= segTotal)
+	{
+		sealedY = yco;
+	}
+	else
 	{
-		cursor = lines.begin();
-		while (cursor != lines.end() && (*cursor)->isVisible()) { cursor++; }
+		sealedY = min(yco, materialized ? lines[revealed - matSegBase].y : transcript[revealEntry].y);
 	}
 
-	if (cursor != lines.end())
+	if (yco - tailOffset > y + h)
 	{
+		bool follow = isFollowing();
+		tailOffset += scrollSpeed; // scroll by one pixel
+		if (follow) yoffset = tailOffset;
 		busy = 1;
+	}
 
-		if (waitForAnimationDone)
-		{
-			(*cursor)->update();
-			checkMessages(*cursor);
-		}
-		else
+	prune();
+}
+
+// forget the segments of entries that scrolled out at the top.
+void TextCanvas::prune()
+{
+	if (!isFollowing()) return;
+
+	// segments are ordered by y, so these are always at the front.
+	while (matFirst < matLast && matFirst < revealEntry && (transcript[matFirst].bottom - yoffset) < -MATERIALIZE_MARGIN)
+	{
+		dropFront();
+	}
+}
+
+// forget the segments of the first materialized entry
+void TextCanvas::dropFront()
+{
+	const TranscriptEntry &entry = transcript[matFirst];
+	for (uint32_t i = 0; i < entry.segCount; ++i)
+	{
+		lines.popFront();
+	}
+	if (entry.kind == TranscriptEntry::IMAGE)
+	{
+		assets->unpin(Assets::IMAGE, transcript.getSource(entry.source));
+	}
+	matSegBase += entry.segCount;
+	matFirst++;
+}
+
+// images are pinned for as long as they are laid out. Call this before forgetting all segments.
+void TextCanvas::releaseImages()
+{
+	for (size_t i = max(matFirst, transcript.begin()); i < matLast; ++i)
+	{
+		if (transcript[i].kind == TranscriptEntry::IMAGE)
 		{
-			if (!(*cursor)->isVisible())
-			{
-				startAnimationAtCursor();
-			}
-			else
-			{
-				cursor++;
-				if (cursor != lines.end()) {
-					startAnimationAtCursor();
-				}
-				else {
-					busy = 0;
-				}
-			}
+			assets->unpin(Assets::IMAGE, transcript.getSource(transcript[i].source));
 		}
 	}
+}
 
-	if (yco - yoffset > y + h)
+// lay out the segments of an entry at the end of lines, leaving xco, yco at the end.
+void TextCanvas::layout(const TranscriptEntry &entry)
+{
+	xco = entry.x;
+	yco = entry.y;
+	switch (entry.kind)
 	{
-		yoffset += scrollSpeed; // scroll by one pixel
-		busy = 1;
+	case TranscriptEntry::PLAIN:
+		layoutPlain(transcript.getSource(entry.source), entry.color, entry.font);
+		break;
+	case TranscriptEntry::RICH: {
+		float xflow = xco;
+		float yflow = yco;
+		appendRichText(transcript.getSource(entry.source).c_str(), &xflow, &yflow, w, lines, style);
+		xco = xflow;
+		yco = yflow;
+		break;
+	}
+	case TranscriptEntry::IMAGE: {
+		// the segment refers to the bitmap, so it may not be evicted until the segment is gone.
+		const string &id = transcript.getSource(entry.source);
+		assets->pin(Assets::IMAGE, id);
+		Segment &segment = lines.addImage(xco, yco, assets->getBitmap(id));
+		yco += segment.h;
+		break;
 	}
+	}
+}
+
+void TextCanvas::rebuild(size_t first, size_t last)
+{
+	int savedx = xco;
+	int savedy = yco;
 
-	// clean up lines above the fold...
-	lines.remove_if(ComponentRemover());
+	releaseImages();
+	lines.clear();
+	matFirst = first;
+	matSegBase = (first < transcript.end()) ? transcript[first].segStart : segTotal;
+	for (matLast = first; matLast < last; ++matLast)
+	{
+		layout(transcript[matLast]);
+	}
+
+	xco = savedx;
+	yco = savedy;
 }
 
-void TextCanvas::append(const string &line, ALLEGRO_COLOR color)
+// make sure that all entries overlapping canvas band [top, bottom) are laid out.
+void TextCanvas::materialize(int top, int bottom)
+{
+	size_t first = transcript.firstOverlapping(top);
+	size_t last = transcript.end();
+	if (!isFollowing())
+	{
+		for (last = first; last < transcript.end() && transcript[last].y < bottom; ++last) {}
+	}
+	if (first >= matFirst && last <= matLast) return;
+
+	// lay out some more than needed, so this doesn't happen again for every pixel scrolled.
+	first = transcript.firstOverlapping(top - MATERIALIZE_MARGIN);
+	if (isFollowing())
+	{
+		first = min(first, revealEntry);
+	}
+	else
+	{
+		for (; last < transcript.end() && transcript[last].y < bottom + MATERIALIZE_MARGIN; ++last) {}
+	}
+	rebuild(first, last);
+}
+
+void TextCanvas::scrollBy(int dy)
+{
+	int minOffset = transcript.empty() ? tailOffset : min(tailOffset, transcript[transcript.begin()].y);
+	yoffset = min(tailOffset, max(minOffset, yoffset + dy));
+
+	// back at the end: everything from the appearing text onwards must be laid out.
+	if (isFollowing() && matLast != transcript.end())
+	{
+		rebuild(min(transcript.firstOverlapping(yoffset - MATERIALIZE_MARGIN), revealEntry), transcript.end());
+	}
+}
+
+// lay out a new entry at the end of the transcript
+void TextCanvas::addEntry(TranscriptEntry entry)
+{
+	// new text always shows up at the end
+	scrollToEnd();
+
+	// the reveal starts now, not when the last update happened, which may be a while ago when idle.
+	if (revealed >= segTotal)
+	{
+		lastUpdateTime = Simple::MainLoop::getMainLoop()->getTime();
+		revealBudget = 0;
+	}
+	seal(yco);
+
+	entry.x = xco;
+	entry.y = yco;
+	entry.segStart = segTotal;
+
+	size_t before = lines.size();
+	{
+		LatencyScope scope(Latency::LAYOUT);
+		layout(entry);
+	}
+	entry.segCount = lines.size() - before;
+	entry.bottom = entry.y;
+	for (size_t i = before; i < lines.size(); ++i)
+	{
+		entry.bottom = max(entry.bottom, lines[i].y + lines[i].h);
+	}
+
+	segTotal += entry.segCount;
+	transcript.push(entry);
+	matLast = transcript.end();
+
+	// forget the oldest text that has appeared, when over the memory limit.
+	while (transcript.isOverLimit() && transcript.begin() < revealEntry)
+	{
+		if (matFirst == transcript.begin() && matFirst < matLast)
+		{
+			dropFront();
+		}
+		transcript.popFront();
+	}
+}
+
+void TextCanvas::layoutPlain(const string &line, ALLEGRO_COLOR color, ALLEGRO_FONT *font)
 {
-	assert (activeFont);
 
 	int segstart = 0;
 	int breakPos = -1;
@@ -122,18 +357,16 @@ void TextCanvas::append(const string &line, ALLEGRO_COLOR color)
 		{
 			if (pos - segstart > 0)
 			{
-				auto segment = Text::build(color, line.substr(segstart, (pos-segstart))).xy(xco, yco).font(activeFont).get();
-				segment->setVisible(false);
-				lines.push_back(segment);
+				lines.addText(xco, yco, font, color, line.data() + segstart, pos - segstart);
 			}
 			xco = 0;
-			yco += al_get_font_line_height(activeFont);
+			yco += al_get_font_line_height(font);
 
 			segstart = pos + 1;
 		}
 		else
 		{
-			bool fits = (xco + al_get_text_width(activeFont, line.substr(segstart, (pos-segstart)).c_str()) <= w);
+			bool fits = (xco + al_get_text_width(font, line.substr(segstart, (pos-segstart)).c_str()) <= w);
 
 			if (fits)
 			{
@@ -152,11 +385,8 @@ void TextCanvas::append(const string &line, ALLEGRO_COLOR color)
 			{
 				if (breakPos > 0)
 				{
-					auto segment = Text::build(color, ALLEGRO_ALIGN_LEFT, line.substr(segstart, (breakPos-segstart))).xy(xco, yco).font(activeFont).get();
-					segment->setVisible(false);
-					carriageReturn();
-
-					lines.push_back(segment);
+					lines.addText(xco, yco, font, color, line.data() + segstart, breakPos - segstart);
+					carriageReturn(font);
 
 					segstart = breakPos + 1;
 					nonBreakPos = -1;
@@ -164,11 +394,8 @@ void TextCanvas::append(const string &line, ALLEGRO_COLOR color)
 				}
 				else if (nonBreakPos > 0)
 				{
-					auto segment = Text::build(color, ALLEGRO_ALIGN_LEFT, line.substr(segstart, (nonBreakPos-segstart))).xy(xco, yco).font(activeFont).get();
-					segment->setVisible(false);
-					carriageReturn();
-
-					lines.push_back(segment);
+					lines.addText(xco, yco, font, color, line.data() + segstart, nonBreakPos - segstart);
+					carriageReturn(font);
 
 					segstart = nonBreakPos + 1;
 					nonBreakPos = -1;
@@ -180,7 +407,7 @@ void TextCanvas::append(const string &line, ALLEGRO_COLOR color)
 					{
 						// nothing will fit in remainder of this row. move to the next row
 						xco = 0;
-						yco += al_get_font_line_height(activeFont);
+						yco += al_get_font_line_height(font);
 					}
 					else
 					{
@@ -195,11 +422,8 @@ void TextCanvas::append(const string &line, ALLEGRO_COLOR color)
 	}
 
 	// create segment for remainder
-	auto segment = Text::build(color, ALLEGRO_ALIGN_LEFT, line.substr(segstart, line.length())).xy(xco, yco).font(activeFont).get();
-	segment->setVisible(false);
-	lines.push_back(segment);
-
-	xco += al_get_text_width(activeFont, line.substr(segstart, line.length()).c_str());
+	Segment &segment = lines.addText(xco, yco, font, color, line.data() + segstart, line.length() - segstart);
+	xco += segment.w;
 }
 
 void TextCanvas::appendLine(const string &line)
@@ -207,70 +431,116 @@ void TextCanvas::appendLine(const string &line)
 	append (line, activeColor);
 }
 
+void TextCanvas::append(const string &line, ALLEGRO_COLOR color)
+{
+	assert (activeFont);
+	TranscriptEntry entry = TranscriptEntry();
+	entry.kind = TranscriptEntry::PLAIN;
+	entry.source = transcript.intern(line);
+	entry.color = color;
+	entry.font = activeFont;
+	addEntry(entry);
+}
+
 void TextCanvas::appendRich(const string &line) {
-	float xflow = xco; 
-	float yflow = yco;
-	appendRichText(line.c_str(), &xflow, &yflow, w, lines, style);
-	xco = xflow;
-	yco = yflow;
+	TranscriptEntry entry = TranscriptEntry();
+	entry.kind = TranscriptEntry::RICH;
+	entry.source = transcript.intern(line);
+	addEntry(entry);
 }
 
-void TextCanvas::carriageReturn()
+void TextCanvas::carriageReturn(ALLEGRO_FONT *font)
 {
 	xco = 0;
-	yco += al_get_font_line_height(activeFont);
+	yco += al_get_font_line_height(font);
 }
 
-void TextCanvas::appendImage (ALLEGRO_BITMAP *img)
+void TextCanvas::appendImage (const string &id)
 {
-	auto segment = make_shared<ImageSegment>(img);
-	carriageReturn();
-	segment->setx(xco);
-	segment->sety(yco);
-	yco += al_get_bitmap_height(img);
-	lines.push_back(segment);
+	assert (assets);
+	ALLEGRO_BITMAP *img = assets->getBitmap(id);
+	if (!img) return;
+
+	carriageReturn(activeFont);
+	TranscriptEntry entry = TranscriptEntry();
+	entry.kind = TranscriptEntry::IMAGE;
+	entry.source = transcript.intern(id);
+	growSegmentHeight(al_get_bitmap_height(img));
+	contentWidth = max(contentWidth, xco + al_get_bitmap_width(img));
+	addEntry(entry);
 }
 
-void TextCanvas::draw(const GraphicsContext &gc)
+size_t TextCanvas::firstOverlapping(int yy)
 {
-	GraphicsContext gc2 = GraphicsContext();
-	gc2.xofst = x;
-	gc2.yofst = y - yoffset;
+	return lines.firstOverlapping(yy, maxSegmentHeight);
+}
 
-	for (auto seg : lines)
+void TextCanvas::drawSegments(int top, int bottom, int xofst, int yofst)
+{
+	for (size_t i = firstOverlapping(top); i < lines.size() && lines[i].y < bottom; ++i)
 	{
-		seg->draw(gc2);
+		// segments after the one that is appearing haven't started yet.
+		size_t seg = matSegBase + i;
+		if (seg > revealed) break;
+		lines.draw(lines[i], xofst, yofst, (seg == revealed) ? cursorGlyphs : lines[i].glyphCount);
+	}
+}
 
-		if ((seg->gety() - yoffset) < -400)
-		{
-			seg->kill(); // reclaim..
-		}
+void TextCanvas::draw(const GraphicsContext &gc)
+{
+	// determine the band of canvas coordinates that ends up on the target
+	int saved[4];
+	al_get_clipping_rectangle(&saved[0], &saved[1], &saved[2], &saved[3]);
+	int cx, cy, cw, ch;
+	getClippingRectangle(&cx, &cy, &cw, &ch);
+	int originy = y - yoffset;
+	int top = cy - originy;
+	int bottom = cy + ch - originy;
+	if (!isFollowing())
+	{
+		// when scrolled back, show no more than auto-scrolling would.
+		bottom = min(bottom, yoffset + y + h + maxLineHeight);
+	}
+	if (bottom <= top) return;
+
+	// tiles may stick out of the band
+	materialize(top - tileCache.getTileHeight(), bottom + tileCache.getTileHeight());
+	Stats::set(Stats::SEGMENTS, lines.size());
+
+	setClippingRectangle(cx, cy, cw, originy + bottom - cy);
+	tileCache.setWidth(max(w, contentWidth));
+	int covered = tileCache.draw(top, bottom, sealedY, x, originy, [this](int tileTop, int tileBottom) {
+		drawSegments(tileTop, tileBottom, 0, -tileTop);
+	});
+
+	if (covered < bottom)
+	{
+		// whatever is still appearing is drawn glyph by glyph, clipped so it doesn't overlap the tiles.
+		int clipTop = max(cy, originy + covered);
+		setClippingRectangle(cx, clipTop, cw, originy + bottom - clipTop);
+		drawSegments(max(top, covered), bottom, x, originy);
 	}
+	al_set_clipping_rectangle(saved[0], saved[1], saved[2], saved[3]);
 }
 
 void TextCanvas::setStyle(const StyleData &_style) {
 	style = _style;
+	growLineHeight(al_get_font_line_height(style.normal));
+	growLineHeight(al_get_font_line_height(style.bold));
+	growLineHeight(al_get_font_line_height(style.italic));
+	growLineHeight(al_get_font_line_height(style.header) * 1.5);
 }
 
-ComponentPtr TextCanvas::getComponentAt(int xx, int yy) {
+bool TextCanvas::clickAt(int xx, int yy) {
 	int adjx = xx - x;
 	int adjy = yy - y + yoffset;
 
-	for (auto &c: lines) {
-		if (c->contains(adjx, adjy)) {
-			return c;
-		}
-	}
-	return nullptr;
-}
-
-void ImageSegment::draw(const GraphicsContext &gc)
-{
-	if (isVisible())
-	{
-		if (bmp)
-		{
-			al_draw_bitmap(bmp, x + gc.xofst, y + gc.yofst, 0);
+	for (size_t i = firstOverlapping(adjy); i < lines.size() && lines[i].y <= adjy && matSegBase + i <= revealed; ++i) {
+		const Segment &seg = lines[i];
+		if (seg.type == Segment::LINK && seg.contains(adjx, adjy)) {
+			lines.click(seg);
+			return true;
 		}
 	}
+	return false;
 }
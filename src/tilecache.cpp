@@ -0,0 +1,99 @@
+#include "tilecache.h"
+#include "stats.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void TileCache::clear()
+{
+	for (auto &pair : tiles)
+	{
+		al_destroy_bitmap(pair.second.bmp);
+	}
+	tiles.clear();
+}
+
+void TileCache::setWidth(int w)
+{
+	if (w == tileWidth) return;
+	clear();
+	tileWidth = w;
+}
+
+TileCache::Tile *TileCache::find(int index)
+{
+	auto it = tiles.find(index);
+	return it == tiles.end() ? nullptr : &it->second;
+}
+
+void TileCache::evictAbove(int index)
+{
+	auto end = tiles.lower_bound(index);
+	for (auto it = tiles.begin(); it != end; ++it)
+	{
+		al_destroy_bitmap(it->second.bmp);
+	}
+	tiles.erase(tiles.begin(), end);
+}
+
+// evict least recently used tiles until there is room for one more.
+// Tiles used in the current frame are never evicted.
+bool TileCache::makeRoom()
+{
+	while ((tiles.size() + 1) * tileBytes() > budget)
+	{
+		auto lru = tiles.end();
+		for (auto it = tiles.begin(); it != tiles.end(); ++it)
+		{
+			if (it->second.lastUsed == frame) continue;
+			if (lru == tiles.end() || it->second.lastUsed < lru->second.lastUsed) lru = it;
+		}
+		if (lru == tiles.end()) return false;
+		al_destroy_bitmap(lru->second.bmp);
+		tiles.erase(lru);
+	}
+	return true;
+}
+
+TileCache::Tile *TileCache::create(int index, const RenderFunc &render)
+{
+	if (tileWidth <= 0 || !makeRoom()) return nullptr;
+
+	ALLEGRO_BITMAP *bmp = al_create_bitmap(tileWidth, tileHeight);
+	if (!bmp) return nullptr;
+
+	ALLEGRO_STATE state;
+	al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+	al_set_target_bitmap(bmp);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	render(index * tileHeight, (index + 1) * tileHeight);
+	al_restore_state(&state);
+
+	return &(tiles[index] = Tile { bmp, frame });
+}
+
+int TileCache::draw(int top, int bottom, int sealed, int originx, int originy, const RenderFunc &render)
+{
+	frame++;
+
+	// nothing lives above canvas y == 0
+	int first = max(top, 0) / tileHeight;
+	// keep a view's height above, for scrolling back
+	int margin = (bottom - top) / tileHeight + 1;
+	evictAbove(first - margin);
+
+	int covered = top;
+	for (int i = first; i * tileHeight < bottom && (i + 1) * tileHeight <= sealed; ++i)
+	{
+		Tile *tile = find(i);
+		if (!tile) tile = create(i, render);
+		if (!tile) break; // over budget, the remainder is drawn directly
+
+		tile->lastUsed = frame;
+		al_draw_bitmap(tile->bmp, originx, originy + i * tileHeight, 0);
+		Stats::add(Stats::DRAW_CALLS);
+		covered = (i + 1) * tileHeight;
+	}
+	return covered;
+}
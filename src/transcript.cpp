@@ -0,0 +1,91 @@
+#include "transcript.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+uint32_t Transcript::intern(const string &text)
+{
+	auto it = ids.find(string_view(text));
+	if (it != ids.end())
+	{
+		refs[it->second]++;
+		return it->second;
+	}
+
+	uint32_t id;
+	if (freeIds.empty())
+	{
+		id = sources.size();
+		sources.push_back(text);
+		refs.push_back(1);
+	}
+	else
+	{
+		id = freeIds.back();
+		freeIds.pop_back();
+		sources[id] = text;
+		refs[id] = 1;
+	}
+	sourceBytes += text.size();
+	ids[string_view(sources[id])] = id;
+	return id;
+}
+
+void Transcript::release(uint32_t id)
+{
+	assert (refs[id] > 0);
+	if (--refs[id] > 0) return;
+
+	ids.erase(string_view(sources[id]));
+	sourceBytes -= sources[id].size();
+	sources[id] = string();
+	freeIds.push_back(id);
+}
+
+void Transcript::push(const TranscriptEntry &entry)
+{
+	maxHeight = max(maxHeight, entry.bottom - entry.y);
+	entries.push_back(entry);
+}
+
+void Transcript::popFront()
+{
+	release(entries.front().source);
+	entries.pop_front();
+	base++;
+}
+
+void Transcript::popBack()
+{
+	release(entries.back().source);
+	entries.pop_back();
+}
+
+void Transcript::clear()
+{
+	entries.clear();
+	base = 0;
+	sources.clear();
+	refs.clear();
+	freeIds.clear();
+	ids.clear();
+	sourceBytes = 0;
+	maxHeight = 0;
+}
+
+size_t Transcript::firstOverlapping(int yy) const
+{
+	// entries start in flow order, so they are sorted by y.
+	auto it = lower_bound(entries.begin(), entries.end(), yy - maxHeight + 1, [](const TranscriptEntry &entry, int val) {
+		return entry.y < val;
+	});
+	return base + (it - entries.begin());
+}
+
+size_t Transcript::getBytes() const
+{
+	// rough estimate, including overhead of the lookup table
+	return entries.size() * sizeof(TranscriptEntry) + sourceBytes + sources.size() * (sizeof(string) + 32);
+}
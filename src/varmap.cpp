@@ -0,0 +1,81 @@
+#include "varmap.h"
+
+#include <algorithm>
+
+using namespace std;
+
+VarMap::NodePtr VarMap::make(const string &key, int value, const NodePtr &left, const NodePtr &right)
+{
+	return make_shared<const Node>(Node { key, value, max(height(left), height(right)) + 1, left, right });
+}
+
+// AVL rotations, on copies: the nodes passed in may be shared and are left alone.
+VarMap::NodePtr VarMap::balance(const string &key, int value, const NodePtr &left, const NodePtr &right)
+{
+	int diff = height(left) - height(right);
+	if (diff > 1)
+	{
+		if (height(left->left) >= height(left->right))
+		{
+			return make(left->key, left->value, left->left, make(key, value, left->right, right));
+		}
+		const Node &mid = *left->right;
+		return make(mid.key, mid.value,
+			make(left->key, left->value, left->left, mid.left),
+			make(key, value, mid.right, right));
+	}
+	if (diff < -1)
+	{
+		if (height(right->right) >= height(right->left))
+		{
+			return make(right->key, right->value, make(key, value, left, right->left), right->right);
+		}
+		const Node &mid = *right->left;
+		return make(mid.key, mid.value,
+			make(key, value, left, mid.left),
+			make(right->key, right->value, mid.right, right->right));
+	}
+	return make(key, value, left, right);
+}
+
+VarMap::NodePtr VarMap::insert(const NodePtr &node, const string &key, int value, bool &added)
+{
+	if (!node)
+	{
+		added = true;
+		return make(key, value, nullptr, nullptr);
+	}
+	int cmp = key.compare(node->key);
+	if (cmp < 0) return balance(node->key, node->value, insert(node->left, key, value, added), node->right);
+	if (cmp > 0) return balance(node->key, node->value, node->left, insert(node->right, key, value, added));
+	return make(key, value, node->left, node->right);
+}
+
+const int *VarMap::find(const string &key) const
+{
+	const Node *node = root.get();
+	while (node)
+	{
+		int cmp = key.compare(node->key);
+		if (cmp == 0) return &node->value;
+		node = (cmp < 0) ? node->left.get() : node->right.get();
+	}
+	return nullptr;
+}
+
+int VarMap::get(const string &key) const
+{
+	const int *value = find(key);
+	return value ? *value : 0;
+}
+
+void VarMap::set(const string &key, int value)
+{
+	const int *current = find(key);
+	// no new version for a variable that doesn't change, e.g. SET of a flag that is already set
+	if (current && *current == value) return;
+
+	bool added = false;
+	root = insert(root, key, value, added);
+	if (added) count++;
+}
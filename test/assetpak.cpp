@@ -0,0 +1,105 @@
+#include "test.h"
+#include "assetpak.h"
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace std;
+
+// an archive with one 2x2 image, whose record can be changed before writing
+static void writePak(const string &path, AssetPak::Record record, size_t pixelBytes = 16)
+{
+	AssetPak::Header header;
+	memcpy(header.magic, "KPAK", 4);
+	header.version = AssetPak::VERSION;
+	header.count = 1;
+	header.reserved = 0;
+
+	ofstream out(path, ios::binary);
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)&record, sizeof(record));
+	vector<char> pixels(pixelBytes, 0x7f);
+	out.write(pixels.data(), pixels.size());
+}
+
+static AssetPak::Record makeRecord(const char *id, uint32_t width, uint32_t height)
+{
+	AssetPak::Record record = {};
+	strncpy(record.id, id, sizeof(record.id) - 1);
+	record.width = width;
+	record.height = height;
+	record.offset = sizeof(AssetPak::Header) + sizeof(AssetPak::Record);
+	return record;
+}
+
+int main()
+{
+	test::TempFile file("assetpak");
+
+	// valid
+	{
+		writePak(file.get(), makeRecord("castle", 2, 2));
+		AssetPak pak;
+		CHECK(pak.open(file.get()));
+		CHECK(pak.getCount() == 1);
+		CHECK(pak.find("castle", 100) != nullptr);
+		CHECK(pak.find("tower", 100) == nullptr);
+	}
+
+	// pixels run past the end of the file
+	{
+		writePak(file.get(), makeRecord("castle", 2, 2), 15);
+		AssetPak pak;
+		CHECK(!pak.open(file.get()));
+		CHECK(!pak.isOpen());
+	}
+
+	// an offset so large that offset + size wraps around
+	{
+		AssetPak::Record record = makeRecord("castle", 2, 2);
+		record.offset = UINT64_MAX - 8;
+		writePak(file.get(), record);
+		AssetPak pak;
+		CHECK(!pak.open(file.get()));
+	}
+
+	// width * height * 4 doesn't fit in 64 bits
+	{
+		writePak(file.get(), makeRecord("castle", 0xFFFFFFFF, 0xFFFFFFFF));
+		AssetPak pak;
+		CHECK(!pak.open(file.get()));
+	}
+
+	// id without terminating zero
+	{
+		AssetPak::Record record = makeRecord("castle", 2, 2);
+		memset(record.id, 'x', sizeof(record.id));
+		writePak(file.get(), record);
+		AssetPak pak;
+		CHECK(!pak.open(file.get()));
+	}
+
+	// wrong magic, and an index that is cut short
+	{
+		writePak(file.get(), makeRecord("castle", 2, 2));
+		{
+			fstream f(file.get(), ios::binary | ios::in | ios::out);
+			f.write("XPAK", 4);
+		}
+		AssetPak pak;
+		CHECK(!pak.open(file.get()));
+
+		ofstream out(file.get(), ios::binary);
+		AssetPak::Header header;
+		memcpy(header.magic, "KPAK", 4);
+		header.version = AssetPak::VERSION;
+		header.count = 1000;
+		header.reserved = 0;
+		out.write((const char*)&header, sizeof(header));
+		out.close();
+		CHECK(!pak.open(file.get()));
+	}
+
+	return test::report("assetpak");
+}
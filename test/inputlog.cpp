@@ -0,0 +1,100 @@
+#include "test.h"
+#include "inputlog.h"
+
+#include <fstream>
+
+using namespace std;
+
+int main()
+{
+	test::TempFile file("inputlog");
+
+	// what is recorded comes back, on the same ticks
+	{
+		InputLog log;
+		CHECK(log.startRecording(file.get(), 20));
+
+		ALLEGRO_EVENT key = {};
+		key.keyboard.type = ALLEGRO_EVENT_KEY_CHAR;
+		key.keyboard.keycode = ALLEGRO_KEY_ENTER;
+		key.keyboard.unichar = 13;
+		key.keyboard.modifiers = 0;
+		key.keyboard.repeat = false;
+		log.record(3, key);
+
+		ALLEGRO_EVENT mouse = {};
+		mouse.mouse.type = ALLEGRO_EVENT_MOUSE_AXES;
+		mouse.mouse.x = 120;
+		mouse.mouse.y = -4;
+		mouse.mouse.dz = -1;
+		log.record(7, mouse);
+
+		ALLEGRO_EVENT resize = {};
+		resize.display.type = ALLEGRO_EVENT_DISPLAY_RESIZE;
+		resize.display.width = 800;
+		resize.display.height = 600;
+		log.record(7, resize);
+
+		// not input, not recorded
+		ALLEGRO_EVENT timer = {};
+		timer.type = ALLEGRO_EVENT_TIMER;
+		log.record(8, timer);
+
+		log.stopRecording(12);
+		CHECK(!log.isRecording());
+	}
+	{
+		InputLog log;
+		CHECK(log.load(file.get(), 20));
+		CHECK(log.isReplaying());
+		CHECK(log.getEndTick() == 12);
+
+		ALLEGRO_EVENT event;
+		CHECK(!log.pop(2, event));
+		CHECK(log.pop(3, event));
+		CHECK(event.type == ALLEGRO_EVENT_KEY_CHAR);
+		CHECK(event.keyboard.keycode == ALLEGRO_KEY_ENTER);
+		CHECK(event.keyboard.unichar == 13);
+		CHECK(!log.pop(6, event));
+
+		CHECK(log.pop(7, event));
+		CHECK(event.type == ALLEGRO_EVENT_MOUSE_AXES);
+		CHECK(event.mouse.x == 120 && event.mouse.y == -4 && event.mouse.dz == -1);
+		CHECK(log.pop(7, event));
+		CHECK(event.type == ALLEGRO_EVENT_DISPLAY_RESIZE);
+		CHECK(event.display.width == 800 && event.display.height == 600);
+
+		CHECK(!log.pop(100, event));
+		CHECK(log.isDone());
+	}
+
+	// cut short: no end line, and a last line that is incomplete
+	{
+		ofstream out(file.get());
+		out << "twist-input 1 20\n";
+		out << "5 K " << ALLEGRO_EVENT_KEY_DOWN << " " << ALLEGRO_KEY_SPACE << " 0 0 0\n";
+		out << "9 M " << ALLEGRO_EVENT_MOUSE_AXES << " 1 2\n";
+		out.close();
+
+		InputLog log;
+		CHECK(log.load(file.get(), 20));
+		CHECK(log.getEndTick() == 5);
+		ALLEGRO_EVENT event;
+		CHECK(log.pop(5, event));
+		CHECK(event.keyboard.keycode == ALLEGRO_KEY_SPACE);
+		CHECK(log.isDone());
+	}
+
+	// not a recording
+	{
+		ofstream out(file.get());
+		out << "hello world\n";
+		out.close();
+
+		InputLog log;
+		CHECK(!log.load(file.get(), 20));
+		CHECK(!log.isReplaying());
+	}
+
+	return test::report("inputlog");
+}
@@ -0,0 +1,179 @@
+#include "test.h"
+#include "jobs.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// a job blocks on it until it is opened
+class Gate {
+	mutex m;
+	condition_variable cv;
+	bool open = false;
+public:
+	void pass()
+	{
+		unique_lock<mutex> lock(m);
+		cv.wait(lock, [this]() { return open; });
+	}
+	void release()
+	{
+		{
+			lock_guard<mutex> guard(m);
+			open = true;
+		}
+		cv.notify_all();
+	}
+};
+
+// without wait(), so a broken scheduler fails the test instead of hanging it
+static bool finishes(const JobSystem::Handle &job)
+{
+	auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+	while (!job->isDone())
+	{
+		if (chrono::steady_clock::now() > deadline) return false;
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+	return true;
+}
+
+// wait() returns once the work is done, the completion may be queued a moment later
+static bool complete(JobSystem &jobs, const JobSystem::Handle &job)
+{
+	auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+	while (!job->isDone())
+	{
+		if (chrono::steady_clock::now() > deadline) return false;
+		jobs.runCompletions(1000);
+	}
+	return true;
+}
+
+int main()
+{
+	al_init();
+
+	// one worker, kept busy while the others are queued: then it takes the highest priority first, oldest first
+	{
+		JobSystem jobs(1);
+		Gate gate;
+		atomic<bool> started(false);
+		auto blocker = jobs.submit([&]() { started = true; gate.pass(); });
+		while (!started) this_thread::yield();
+
+		mutex orderMutex;
+		string order;
+		auto add = [&](char c) {
+			return [&, c]() {
+				lock_guard<mutex> guard(orderMutex);
+				order += c;
+			};
+		};
+		vector<JobSystem::Handle> handles = {
+			jobs.submit(add('a'), JobSystem::LOW),
+			jobs.submit(add('b'), JobSystem::NORMAL),
+			jobs.submit(add('c'), JobSystem::HIGH),
+			jobs.submit(add('d'), JobSystem::NORMAL),
+		};
+		CHECK(jobs.getQueueDepth() == 4);
+		gate.release();
+		for (auto &job : handles)
+		{
+			CHECK(finishes(job));
+		}
+		CHECK(order == "cbda");
+		CHECK(jobs.getQueueDepth() == 0);
+	}
+
+	// cancelled before it started: neither the work nor the completion runs
+	{
+		JobSystem jobs(1);
+		Gate gate;
+		atomic<bool> started(false);
+		auto blocker = jobs.submit([&]() { started = true; gate.pass(); });
+		while (!started) this_thread::yield();
+
+		bool worked = false, completed = false;
+		auto job = jobs.submit([&]() { worked = true; }, JobSystem::NORMAL, [&]() { completed = true; });
+		jobs.cancel(job);
+		CHECK(job->isCancelled() && job->isDone());
+		gate.release();
+		jobs.wait(job);
+		CHECK(finishes(blocker));
+		jobs.runCompletions(1000);
+		CHECK(!worked && !completed);
+	}
+
+	// cancelled while running: the work sees it and may stop, the completion doesn't run
+	{
+		JobSystem jobs(1);
+		Gate gate;
+		atomic<bool> started(false);
+		bool sawCancel = false, completed = false;
+		auto job = jobs.submit([&]() {
+			started = true;
+			gate.pass();
+			sawCancel = JobSystem::isCurrentCancelled();
+		}, JobSystem::NORMAL, [&]() { completed = true; });
+		while (!started) this_thread::yield();
+		CHECK(!JobSystem::isCurrentCancelled()); // not in a job
+		jobs.cancel(job);
+		CHECK(!job->isDone()); // still running
+		gate.release();
+		jobs.wait(job);
+		CHECK(job->isDone());
+		jobs.runCompletions(1000);
+		CHECK(sawCancel && !completed);
+	}
+
+	// completions run on the thread that calls runCompletions, and only there. wait() doesn't run them.
+	{
+		JobSystem jobs(2);
+		thread::id worker, completion;
+		int completions = 0;
+		auto job = jobs.submit([&]() { worker = this_thread::get_id(); }, JobSystem::NORMAL, [&]() {
+			completion = this_thread::get_id();
+			completions++;
+		});
+		jobs.wait(job);
+		CHECK(worker != this_thread::get_id());
+		CHECK(completions == 0 && !job->isDone());
+		CHECK(complete(jobs, job));
+		CHECK(completions == 1 && completion == this_thread::get_id());
+
+		// waiting for a finished job returns right away, and nothing runs twice
+		jobs.wait(job);
+		jobs.runCompletions(1000);
+		CHECK(completions == 1);
+
+		// a job without a completion is done when its work is
+		auto plain = jobs.submit([]() {});
+		jobs.wait(plain);
+		CHECK(plain->isDone());
+	}
+
+	// a job on the queue of a busy worker is stolen by the other one
+	{
+		JobSystem jobs(2);
+		Gate gate;
+		atomic<bool> started(false);
+		auto blocker = jobs.submit([&]() { started = true; gate.pass(); });
+		while (!started) this_thread::yield();
+		// dealt out over both queues, so one of them is behind the blocker
+		auto first = jobs.submit([]() {});
+		auto second = jobs.submit([]() {});
+		CHECK(finishes(first) && finishes(second));
+		CHECK(!blocker->isDone());
+		gate.release();
+		CHECK(finishes(blocker));
+	}
+
+	return test::report("jobs");
+}
@@ -0,0 +1,120 @@
+#include "test.h"
+#include "journal.h"
+#include "savegame.h"
+
+#include <fstream>
+
+using namespace std;
+
+static vector<Journal::Choice> readChoices(const string &path, string &snapshot)
+{
+	vector<Journal::Choice> choices;
+	Journal reader(path);
+	if (!reader.read(snapshot, choices)) snapshot = "(invalid)";
+	return choices;
+}
+
+static bool sameChoice(const Journal::Choice &choice, int index, int lineno)
+{
+	return choice.index == index && choice.lineno == lineno;
+}
+
+int main()
+{
+	test::TempFile file("journal");
+	string snapshot;
+
+	// nothing there yet
+	{
+		Journal journal(file.get());
+		vector<Journal::Choice> choices;
+		CHECK(!journal.read(snapshot, choices));
+	}
+
+	Journal journal(file.get());
+	journal.start("first");
+	CHECK(journal.write());
+	journal.append({ 0, 10 });
+	journal.append({ 2, 300 }); // a line number of more than one byte
+	journal.append({ 1, 20 });
+	CHECK(journal.getChoiceCount() == 3);
+	CHECK(journal.getRecordCount() == 3);
+
+	// appended records are in the file right away
+	{
+		vector<Journal::Choice> choices = readChoices(file.get(), snapshot);
+		CHECK(snapshot == "first");
+		CHECK(choices.size() == 3);
+		CHECK(choices.size() == 3 && sameChoice(choices[0], 0, 10) && sameChoice(choices[1], 2, 300) && sameChoice(choices[2], 1, 20));
+	}
+
+	// compact to the snapshot before the third choice: only that one is left
+	uint64_t epoch = journal.getEpoch();
+	CHECK(journal.compact("third", 2, epoch));
+	CHECK(journal.getChoiceCount() == 3);
+	CHECK(journal.getRecordCount() == 1);
+	// until it is written, appends go to the old file
+	journal.append({ 4, 40 });
+	{
+		vector<Journal::Choice> choices = readChoices(file.get(), snapshot);
+		CHECK(snapshot == "first" && choices.size() == 4);
+	}
+	CHECK(journal.write());
+	{
+		vector<Journal::Choice> choices = readChoices(file.get(), snapshot);
+		CHECK(snapshot == "third");
+		CHECK(choices.size() == 2 && sameChoice(choices[0], 1, 20) && sameChoice(choices[1], 4, 40));
+	}
+	// not before what was compacted already, nor beyond the last choice, nor from before that compaction
+	CHECK(!journal.compact("old", 1, journal.getEpoch()));
+	CHECK(!journal.compact("future", 5, journal.getEpoch()));
+	CHECK(!journal.compact("stale", 3, epoch));
+
+	// start over. Appends before the write are kept for it.
+	journal.start("discarded");
+	journal.start("again");
+	CHECK(journal.getChoiceCount() == 0);
+	{
+		vector<Journal::Choice> choices = readChoices(file.get(), snapshot);
+		CHECK(snapshot == "third");
+	}
+	journal.append({ 1, 11 });
+	CHECK(journal.write());
+	{
+		vector<Journal::Choice> choices = readChoices(file.get(), snapshot);
+		CHECK(snapshot == "again" && choices.size() == 1 && sameChoice(choices[0], 1, 11));
+	}
+	journal.append({ 2, 22 });
+	journal.close();
+
+	string data;
+	CHECK(SaveGame::readFile(file.get(), data));
+
+	// a crash in the middle of the last record: that one is ignored
+	{
+		ofstream(file.get(), ios::binary) << data.substr(0, data.size() - 1);
+		vector<Journal::Choice> choices = readChoices(file.get(), snapshot);
+		CHECK(snapshot == "again");
+		CHECK(choices.size() == 1 && sameChoice(choices[0], 1, 11));
+	}
+
+	// a damaged record: it and everything after it is ignored
+	{
+		string damaged = data;
+		damaged[damaged.size() - 3] ^= 0x01; // in the last record
+		ofstream(file.get(), ios::binary) << damaged;
+		vector<Journal::Choice> choices = readChoices(file.get(), snapshot);
+		CHECK(choices.size() == 1);
+	}
+
+	// a damaged header means there is nothing to resume
+	{
+		string damaged = data;
+		damaged[0] = 'X';
+		ofstream(file.get(), ios::binary) << damaged;
+		readChoices(file.get(), snapshot);
+		CHECK(snapshot == "(invalid)");
+	}
+
+	return test::report("journal");
+}
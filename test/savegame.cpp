@@ -0,0 +1,105 @@
+#include "test.h"
+#include "savegame.h"
+#include "parser.h"
+
+#include <climits>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+static bool sameState(const SimpleState &a, const SimpleState &b)
+{
+	if (a.currentNodeName != b.currentNodeName || a.gameVariables.size() != b.gameVariables.size()) return false;
+	bool same = true;
+	a.gameVariables.forEach([&](const string &key, int value) {
+		const int *other = b.gameVariables.find(key);
+		if (!other || *other != value) same = false;
+	});
+	return same;
+}
+
+int main()
+{
+	// the standard check value of CRC-32
+	CHECK(SaveGame::crc32("123456789", 9) == 0xCBF43926);
+	// and it can be continued
+	CHECK(SaveGame::crc32("56789", 5, SaveGame::crc32("1234", 4)) == 0xCBF43926);
+
+	Story story;
+	story.flags = { "lamp", "key" };
+	story.nodes["START"] = Node("START");
+	uint32_t hash = SaveGame::hashStory(story);
+	Story other = story;
+	other.flags.push_back("rope");
+	CHECK(SaveGame::hashStory(other) != hash);
+
+	SimpleState state;
+	state.currentNodeName = "CELLAR";
+	state.gameVariables.set("lamp", 1);
+	state.gameVariables.set("key", 0);
+	state.gameVariables.set("gold", -1); // zigzag
+	state.gameVariables.set("big", INT_MAX);
+	state.gameVariables.set("small", INT_MIN);
+	vector<int> answers = { 12, 300, 70000 };
+	string data = SaveGame::encode(state, answers, hash);
+
+	// round trip
+	{
+		SimpleState loaded;
+		vector<int> loadedAnswers;
+		CHECK(SaveGame::decode(data, hash, loaded, loadedAnswers));
+		CHECK(sameState(state, loaded));
+		CHECK(loadedAnswers == answers);
+	}
+
+	// rejected, and nothing changed: another story, a damaged byte, cut short, or anything appended
+	{
+		SimpleState loaded;
+		loaded.currentNodeName = "UNCHANGED";
+		vector<int> loadedAnswers;
+		CHECK(!SaveGame::decode(data, hash + 1, loaded, loadedAnswers));
+		for (size_t i = 0; i < data.size(); ++i)
+		{
+			string damaged = data;
+			damaged[i] ^= 0x10;
+			CHECK(!SaveGame::decode(damaged, hash, loaded, loadedAnswers));
+		}
+		for (size_t len = 0; len < data.size(); ++len)
+		{
+			CHECK(!SaveGame::decode(data.substr(0, len), hash, loaded, loadedAnswers));
+		}
+		CHECK(!SaveGame::decode(data + "x", hash, loaded, loadedAnswers));
+		CHECK(loaded.currentNodeName == "UNCHANGED");
+		CHECK(loadedAnswers.empty());
+	}
+
+	// the text saves of earlier versions
+	{
+		SimpleState legacy;
+		istringstream in("NODE=CELLAR\nlamp=1\nkey=0\ngold=-1\n");
+		CHECK(SaveGame::decodeLegacy(in, legacy));
+		CHECK(legacy.currentNodeName == "CELLAR" && legacy.gameVariables.get("gold") == -1 && legacy.gameVariables.size() == 3);
+
+		legacy.currentNodeName = "UNCHANGED";
+		istringstream noNode("lamp=1\n");
+		CHECK(!SaveGame::decodeLegacy(noNode, legacy));
+		istringstream badValue("NODE=CELLAR\nlamp=one\n");
+		CHECK(!SaveGame::decodeLegacy(badValue, legacy));
+		CHECK(legacy.currentNodeName == "UNCHANGED");
+	}
+
+	// files are replaced as a whole, no temporary file is left behind
+	{
+		test::TempFile file("savegame");
+		string read;
+		CHECK(!SaveGame::readFile(file.get(), read));
+		CHECK(SaveGame::writeFile(file.get(), data));
+		CHECK(SaveGame::readFile(file.get(), read) && read == data);
+		CHECK(SaveGame::writeFile(file.get(), "short"));
+		CHECK(SaveGame::readFile(file.get(), read) && read == "short");
+		CHECK(!SaveGame::readFile(file.get() + ".tmp", read));
+	}
+
+	return test::report("savegame");
+}
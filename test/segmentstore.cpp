@@ -0,0 +1,110 @@
+#include "test.h"
+#include "segmentstore.h"
+
+#include <allegro5/allegro_font.h>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+static Segment &addText(SegmentStore &store, int x, int y, ALLEGRO_FONT *font, const char *s)
+{
+	return store.addText(x, y, font, al_map_rgb(255, 255, 255), s, strlen(s));
+}
+
+int main()
+{
+	al_init();
+	al_init_font_addon();
+	ALLEGRO_FONT *font = al_create_builtin_font();
+	CHECK(font);
+	if (!font) return test::report("segmentstore");
+	int h = al_get_font_line_height(font);
+
+	// the first segment overlapping a y coordinate, by binary search
+	{
+		SegmentStore store;
+		for (int y : { 0, 0, 2 * h, 4 * h, 4 * h, 6 * h })
+		{
+			addText(store, 0, y, font, "word");
+		}
+		CHECK(store.firstOverlapping(-100, h) == 0);
+		CHECK(store.firstOverlapping(0, h) == 0);
+		CHECK(store.firstOverlapping(h - 1, h) == 0); // the last row of the first line
+		CHECK(store.firstOverlapping(h, h) == 2); // in between lines
+		CHECK(store.firstOverlapping(2 * h + 1, h) == 2);
+		CHECK(store.firstOverlapping(3 * h, h) == 3);
+		CHECK(store.firstOverlapping(6 * h + h - 1, h) == 5);
+		CHECK(store.firstOverlapping(7 * h, h) == 6); // below everything
+		// a taller segment somewhere means looking further up
+		CHECK(store.firstOverlapping(3 * h, 3 * h) == 2);
+	}
+
+	// dropped from the front, and compacted on the way: the rest keep their text, glyphs and links
+	{
+		al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+		ALLEGRO_BITMAP *bmp = al_create_bitmap(16, 24);
+		SegmentStore store;
+		int clicked = -1;
+		auto add = [&](int i) {
+			string s = "seg" + to_string(i);
+			if (i % 10 == 3)
+			{
+				store.addLink(0, i * h, font, al_map_rgb(0, 0, 255), s.data(), s.size(), [&clicked, i]() { clicked = i; });
+			}
+			else if (i % 10 == 7)
+			{
+				store.addImage(0, i * h, bmp);
+			}
+			else
+			{
+				addText(store, 0, i * h, font, s.c_str());
+			}
+		};
+		// everything from first up to last is in the store, in order
+		auto intact = [&](int first, int last) {
+			if (store.size() != (size_t)(last - first)) return false;
+			for (int i = first; i < last; ++i)
+			{
+				const Segment &seg = store[i - first];
+				if (seg.y != i * h) return false;
+				if (i % 10 == 7)
+				{
+					if (seg.type != Segment::IMAGE || seg.bmp != bmp || seg.w != 16 || seg.glyphCount != 1) return false;
+					continue;
+				}
+				string s = "seg" + to_string(i);
+				if (string(store.getText(seg), seg.textLen) != s || seg.glyphCount != s.size()) return false;
+				if (store.getGlyphRight(seg, 3) != al_get_text_width(font, "seg")) return false;
+				if (store.getGlyphRight(seg, seg.glyphCount) != seg.w) return false;
+				clicked = -1;
+				store.click(seg);
+				if (clicked != (i % 10 == 3 ? i : -1)) return false;
+			}
+			return true;
+		};
+
+		for (int i = 0; i < 100; ++i) add(i);
+		CHECK(intact(0, 100));
+		for (int i = 0; i < 70; ++i) store.popFront(); // compacts once at least half is unused
+		CHECK(intact(70, 100));
+		CHECK(store.front().y == 70 * h);
+		CHECK(store.firstOverlapping(80 * h, h) == 10);
+
+		// appending after compaction
+		for (int i = 100; i < 120; ++i) add(i);
+		CHECK(intact(70, 120));
+
+		store.clear();
+		CHECK(store.empty());
+
+		// compacted with an image in front, whose text offset means nothing
+		for (int i = 0; i < 134; ++i) add(i);
+		for (int i = 0; i < 67; ++i) store.popFront();
+		CHECK(intact(67, 134));
+		al_destroy_bitmap(bmp);
+	}
+
+	al_destroy_font(font);
+	return test::report("segmentstore");
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+/**
+ * Checks for the unit tests in this directory. Each test is a program of its own,
+ * that reports the failed checks and returns nonzero if there were any. Run them all with make test.
+ */
+namespace test {
+
+inline int failures = 0;
+
+inline int report(const char *name)
+{
+	std::cout << name << ": " << (failures ? "FAILED" : "ok") << std::endl;
+	return failures ? 1 : 0;
+}
+
+/** Path of a scratch file, removed when this goes out of scope */
+class TempFile {
+	std::string path;
+public:
+	explicit TempFile(const std::string &name) : path("test_" + name + ".tmp") { std::remove(path.c_str()); }
+	~TempFile() { std::remove(path.c_str()); }
+	const std::string &get() const { return path; }
+};
+
+}
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+		test::failures++; \
+	} \
+} while (0)
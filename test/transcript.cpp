@@ -0,0 +1,101 @@
+#include "test.h"
+#include "transcript.h"
+
+#include <string>
+
+using namespace std;
+
+static TranscriptEntry entry(uint32_t source, int y, int height)
+{
+	TranscriptEntry result = TranscriptEntry();
+	result.kind = TranscriptEntry::PLAIN;
+	result.source = source;
+	result.y = y;
+	result.bottom = y + height;
+	return result;
+}
+
+int main()
+{
+	// identical text is stored once, and kept until the last entry using it is gone
+	{
+		Transcript transcript;
+		uint32_t hello = transcript.intern("hello");
+		transcript.push(entry(hello, 0, 10));
+		CHECK(transcript.intern("hello") == hello);
+		transcript.push(entry(hello, 10, 10));
+		uint32_t world = transcript.intern("world");
+		CHECK(world != hello);
+		transcript.push(entry(world, 20, 10));
+		size_t bytes = transcript.getBytes();
+
+		transcript.popFront();
+		CHECK(transcript.getSource(hello) == "hello");
+		transcript.popFront();
+		CHECK(transcript.getBytes() < bytes);
+		// the id is free, and taken by the next new text
+		uint32_t again = transcript.intern("again");
+		CHECK(again == hello && transcript.getSource(again) == "again");
+		CHECK(transcript.getSource(world) == "world");
+
+		// popping from the back releases too
+		transcript.push(entry(again, 30, 10));
+		transcript.popBack();
+		CHECK(transcript.intern("other") == again);
+	}
+
+	// indices stay the same when entries are dropped from the front
+	{
+		Transcript transcript;
+		for (int i = 0; i < 5; ++i)
+		{
+			transcript.push(entry(transcript.intern("line " + to_string(i)), i * 10, 10));
+		}
+		CHECK(transcript.begin() == 0 && transcript.end() == 5);
+		transcript.popFront();
+		transcript.popFront();
+		CHECK(transcript.begin() == 2 && transcript.end() == 5);
+		CHECK(transcript[2].y == 20 && transcript.getSource(transcript[4].source) == "line 4");
+		transcript.popBack();
+		CHECK(transcript.end() == 4);
+
+		transcript.clear();
+		CHECK(transcript.empty() && transcript.begin() == 0 && transcript.end() == 0);
+	}
+
+	// the memory limit
+	{
+		Transcript transcript;
+		transcript.setLimit(transcript.getBytes() + 1000);
+		int i = 0;
+		while (!transcript.isOverLimit())
+		{
+			transcript.push(entry(transcript.intern(string(100, 'a' + i % 26) + to_string(i)), i * 10, 10));
+			i++;
+		}
+		CHECK(i > 1 && i < 20);
+		transcript.popFront();
+		CHECK(!transcript.isOverLimit());
+	}
+
+	// the first entry that could overlap a y coordinate
+	{
+		Transcript transcript;
+		transcript.push(entry(transcript.intern("text"), 0, 10));
+		transcript.push(entry(transcript.intern("text"), 10, 30)); // the tallest
+		transcript.push(entry(transcript.intern("text"), 40, 10));
+		transcript.push(entry(transcript.intern("text"), 50, 10));
+		CHECK(transcript.firstOverlapping(-5) == 0);
+		CHECK(transcript.firstOverlapping(5) == 0);
+		CHECK(transcript.firstOverlapping(35) == 1); // in the tall one
+		CHECK(transcript.firstOverlapping(45) == 2);
+		CHECK(transcript.firstOverlapping(75) == 3);
+		CHECK(transcript.firstOverlapping(100) == 4);
+		// the same indices after dropping from the front
+		transcript.popFront();
+		CHECK(transcript.firstOverlapping(5) == 1);
+		CHECK(transcript.firstOverlapping(75) == 3);
+	}
+
+	return test::report("transcript");
+}
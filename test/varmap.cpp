@@ -0,0 +1,71 @@
+#include "test.h"
+#include "varmap.h"
+
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+static bool same(const VarMap &vars, const map<string, int> &expected)
+{
+	if (vars.size() != expected.size()) return false;
+	auto it = expected.begin();
+	bool ok = true;
+	vars.forEach([&](const string &key, int value) {
+		if (it == expected.end() || it->first != key || it->second != value) ok = false;
+		else ++it;
+	});
+	return ok;
+}
+
+int main()
+{
+	VarMap vars;
+	CHECK(vars.empty());
+	CHECK(!vars.has("lamp"));
+	CHECK(vars.get("lamp") == 0);
+	CHECK(vars.find("lamp") == nullptr);
+
+	vars.set("lamp", 1);
+	vars.set("lamp", 1);
+	CHECK(vars.size() == 1);
+	CHECK(vars.has("lamp") && vars.get("lamp") == 1);
+
+	// copies are independent
+	VarMap copy = vars;
+	vars.set("lamp", 0);
+	vars.set("key", 1);
+	CHECK(copy.get("lamp") == 1 && !copy.has("key"));
+	CHECK(vars.get("lamp") == 0 && vars.size() == 2);
+
+	// setting while visiting, as UNSET ALL does
+	vars.forEach([&vars](const string &key, int) { vars.set(key, 7); });
+	CHECK(vars.get("lamp") == 7 && vars.get("key") == 7);
+
+	vars.clear();
+	CHECK(vars.empty() && !vars.has("key"));
+	CHECK(copy.size() == 1);
+
+	// against std::map, keeping a version every few steps, in increasing and random key order
+	mt19937 rng(5);
+	VarMap current;
+	map<string, int> expected;
+	vector<pair<VarMap, map<string, int>>> versions;
+	for (int i = 0; i < 5000; ++i)
+	{
+		char key[16];
+		snprintf(key, sizeof(key), "v%04d", i < 1000 ? i : (int)(rng() % 1500));
+		int value = (int)(rng() % 5) - 2;
+		current.set(key, value);
+		expected[key] = value;
+		if (i % 97 == 0) versions.push_back({ current, expected });
+	}
+	CHECK(same(current, expected));
+	for (auto &version : versions)
+	{
+		CHECK(same(version.first, version.second));
+	}
+
+	return test::report("varmap");
+}